@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include "arena.h"
+
+arena::arena()
+	: m_blocks(), m_ptr(nullptr), m_left(0)
+{
+}
+
+arena::arena(arena &&other) noexcept
+	: m_blocks(std::move(other.m_blocks)), m_ptr(other.m_ptr), m_left(other.m_left)
+{
+	other.m_ptr  = nullptr;
+	other.m_left = 0;
+}
+
+arena& arena::operator=(arena &&other) noexcept
+{
+	if (this != &other) {
+		m_blocks = std::move(other.m_blocks);
+		m_ptr    = other.m_ptr;
+		m_left   = other.m_left;
+
+		other.m_ptr  = nullptr;
+		other.m_left = 0;
+	}
+
+	return *this;
+}
+
+void *arena::allocate_slow(size_t size, size_t align)
+{
+	size_t needed = size + align;
+
+	if (needed > block_size / 4) {
+		// Large allocations get their own block, keep using the
+		// current one for small objects
+		m_blocks.emplace_back(new char[needed]);
+
+		char *ptr = m_blocks.back().get();
+		size_t pad = (-reinterpret_cast<uintptr_t>(ptr)) & (align - 1);
+
+		return ptr + pad;
+	}
+
+	m_blocks.emplace_back(new char[block_size]);
+	m_ptr  = m_blocks.back().get();
+	m_left = block_size;
+
+	return allocate(size, align);
+}
+
+void arena::splice(arena &&other)
+{
+	std::move(other.m_blocks.begin(), other.m_blocks.end(),
+		  std::back_inserter(m_blocks));
+
+	other.m_blocks.clear();
+	other.m_ptr  = nullptr;
+	other.m_left = 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <type_traits>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <memory>
+#include <vector>
+#include <new>
+
+// Bump allocator for parsed data. Memory is handed out from large blocks
+// and only released as a whole when the arena is destroyed, so only
+// trivially destructible objects may be put into it.
+class arena {
+private:
+	static const size_t block_size = 1 << 20;
+
+	std::vector<std::unique_ptr<char[]>>	m_blocks;
+	char					*m_ptr;
+	size_t					m_left;
+
+	void *allocate_slow(size_t size, size_t align);
+
+public:
+	arena();
+
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	arena(arena&&) noexcept;
+	arena& operator=(arena&&) noexcept;
+
+	void *allocate(size_t size, size_t align)
+	{
+		size_t pad = (-reinterpret_cast<uintptr_t>(m_ptr)) & (align - 1);
+
+		if (size + pad > m_left)
+			return allocate_slow(size, align);
+
+		void *ret = m_ptr + pad;
+
+		m_ptr  += size + pad;
+		m_left -= size + pad;
+
+		return ret;
+	}
+
+	template<typename T, typename... Args>
+	T *create(Args&&... args)
+	{
+		static_assert(std::is_trivially_destructible<T>::value,
+			      "Arena objects are never destroyed");
+
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	template<typename T>
+	T *copy(const T *src, size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value,
+			      "Arena arrays are copied with memcpy");
+
+		if (count == 0)
+			return nullptr;
+
+		T *dst = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+
+		memcpy(dst, src, sizeof(T) * count);
+
+		return dst;
+	}
+
+	std::string_view copy(std::string_view str)
+	{
+		return std::string_view(copy(str.data(), str.size()), str.size());
+	}
+
+	// Take over all memory of another arena
+	void splice(arena &&other);
+};
+
+#endif
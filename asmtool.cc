@@ -25,6 +25,7 @@
 #include "callgraph.h"
 #include "assembly.h"
 #include "helper.h"
+#include "output.h"
 #include "diff.h"
 #include "copy.h"
 #include "info.h"
@@ -49,6 +50,11 @@ enum {
 	OPTION_DIFF_COLOR,
 	OPTION_DIFF_NO_COLOR,
 	OPTION_DIFF_PRETTY,
+	OPTION_DIFF_KEEP_DEBUG,
+	OPTION_DIFF_ALGORITHM,
+	OPTION_DIFF_JOBS,
+	OPTION_DIFF_TREE,
+	OPTION_DIFF_FORMAT,
 	OPTION_COPY_HELP,
 	OPTION_COPY_OUTPUT,
 	OPTION_INFO_HELP,
@@ -58,14 +64,33 @@ enum {
 	OPTION_INFO_GLOBAL,
 	OPTION_INFO_LOCAL,
 	OPTION_INFO_ALL,
+	OPTION_INFO_FORMAT,
 	OPTION_SHOW_HELP,
 	OPTION_CG_HELP,
 	OPTION_CG_OUTPUT,
 	OPTION_CG_EXTERNAL,
 	OPTION_CG_FUNCTION,
 	OPTION_CG_MAXDEPTH,
+	OPTION_CG_KEEP_DEBUG,
+	OPTION_CG_FORMAT,
 };
 
+static bool parse_format(const char *arg, enum output_format &format)
+{
+	std::string name(arg);
+
+	if (name == "text")
+		format = output_format::TEXT;
+	else if (name == "json")
+		format = output_format::JSON;
+	else if (name == "ndjson")
+		format = output_format::NDJSON;
+	else
+		return false;
+
+	return true;
+}
+
 static struct option diff_options[] = {
 	{ "help",	no_argument,		0, OPTION_DIFF_HELP	},
 	{ "show",	no_argument,		0, OPTION_DIFF_SHOW	},
@@ -73,12 +98,18 @@ static struct option diff_options[] = {
 	{ "pretty",	no_argument,		0, OPTION_DIFF_PRETTY	},
 	{ "color",	no_argument,		0, OPTION_DIFF_COLOR	},
 	{ "no-color",	no_argument,		0, OPTION_DIFF_COLOR	},
+	{ "keep-debug",	no_argument,		0, OPTION_DIFF_KEEP_DEBUG	},
+	{ "algorithm",	required_argument,	0, OPTION_DIFF_ALGORITHM	},
+	{ "jobs",	required_argument,	0, OPTION_DIFF_JOBS	},
+	{ "tree",	no_argument,		0, OPTION_DIFF_TREE	},
+	{ "format",	required_argument,	0, OPTION_DIFF_FORMAT	},
 	{ 0,		0,			0, 0			}
 };
 
 static void usage_diff(const char *cmd)
 {
 	std::cout << "Usage: " << cmd << " diff [options] old_file new_file" << std::endl;
+	std::cout << "       " << cmd << " diff --tree [options] old_dir new_dir" << std::endl;
 	std::cout << "Options:" << std::endl;
 	std::cout << "    --help, -h    - Print this help message" << std::endl;
 	std::cout << "    --show, -s    - Show differences between functions" << std::endl;
@@ -86,12 +117,21 @@ static void usage_diff(const char *cmd)
 	std::cout << "    --pretty, -p  - Print a side-by-side diff" << std::endl;
 	std::cout << "    --color, -c   - Print diff in colors" << std::endl;
 	std::cout << "    --no-color,   - Use no colors" << std::endl;
+	std::cout << "    --keep-debug  - Also load .debug_* sections" << std::endl;
+	std::cout << "    --tree        - Diff all .s files in two directories" << std::endl;
+	std::cout << "    --algorithm <name>" << std::endl;
+	std::cout << "                  - Diff algorithm: myers (default), lcs or hirschberg" << std::endl;
 	std::cout << "    -U <num>      - Lines of context around changes" << std::endl;
+	std::cout << "    --jobs, -j <num>" << std::endl;
+	std::cout << "                  - Number of threads, default is one per CPU" << std::endl;
+	std::cout << "    --format <fmt>" << std::endl;
+	std::cout << "                  - Output format: text (default), json or ndjson" << std::endl;
 }
 
 static int do_diff(const char *cmd, int argc, char **argv)
 {
 	struct diff_options diff_opts;
+	bool tree = false;
 	int c;
 
 	diff_opts.color = isatty(fileno(stdout));
@@ -99,7 +139,7 @@ static int do_diff(const char *cmd, int argc, char **argv)
 	while (true) {
 		int opt_idx;
 
-		c = getopt_long(argc, argv, "hsfU:pc", diff_options, &opt_idx);
+		c = getopt_long(argc, argv, "hsfU:pcj:", diff_options, &opt_idx);
 		if (c == -1)
 			break;
 
@@ -130,6 +170,36 @@ static int do_diff(const char *cmd, int argc, char **argv)
 		case OPTION_DIFF_NO_COLOR:
 			diff_opts.color = false;
 			break;
+		case OPTION_DIFF_KEEP_DEBUG:
+			diff_opts.skip_debug = false;
+			break;
+		case OPTION_DIFF_TREE:
+			tree = true;
+			break;
+		case OPTION_DIFF_JOBS:
+		case 'j':
+			diff_opts.jobs = std::max(atoi(optarg), 1);
+			break;
+		case OPTION_DIFF_FORMAT:
+			if (!parse_format(optarg, diff_opts.format)) {
+				diag() << "Unknown output format: " << optarg << std::endl;
+				usage_diff(cmd);
+				return 1;
+			}
+			break;
+		case OPTION_DIFF_ALGORITHM:
+			if (std::string(optarg) == "myers") {
+				diff_opts.algorithm = diff::algorithm::MYERS;
+			} else if (std::string(optarg) == "lcs") {
+				diff_opts.algorithm = diff::algorithm::LCS;
+			} else if (std::string(optarg) == "hirschberg") {
+				diff_opts.algorithm = diff::algorithm::HIRSCHBERG;
+			} else {
+				diag() << "Unknown diff algorithm: " << optarg << std::endl;
+				usage_diff(cmd);
+				return 1;
+			}
+			break;
 		default:
 			usage_diff(cmd);
 			return 1;
@@ -137,7 +207,7 @@ static int do_diff(const char *cmd, int argc, char **argv)
 	}
 
 	if (optind + 2 > argc) {
-		std::cerr << "Two file parameters required" << std::endl;
+		diag() << "Two file parameters required" << std::endl;
 		usage_diff(cmd);
 		return 1;
 	}
@@ -145,6 +215,11 @@ static int do_diff(const char *cmd, int argc, char **argv)
 	std::string filename1 = argv[optind++];
 	std::string filename2 = argv[optind++];
 
+	if (tree) {
+		diff_trees(filename1, filename2, diff_opts);
+		return 0;
+	}
+
 	auto pos1 = filename1.find_first_of(":");
 	auto pos2 = filename2.find_first_of(":");
 
@@ -204,7 +279,7 @@ static int do_copy(const char *cmd, int argc, char **argv)
 	}
 
 	if (optind + 2 > argc) {
-		std::cerr << "Error: Filename and at least one symbol required" << std::endl;
+		diag() << "Error: Filename and at least one symbol required" << std::endl;
 		usage_copy(cmd);
 		return 1;
 	}
@@ -233,6 +308,7 @@ static struct option info_options[] = {
 	{ "global",	no_argument,		0, OPTION_INFO_GLOBAL		},
 	{ "local",	no_argument,		0, OPTION_INFO_LOCAL		},
 	{ "all",	no_argument,		0, OPTION_INFO_ALL		},
+	{ "format",	required_argument,	0, OPTION_INFO_FORMAT		},
 	{ 0,		0,			0, 0				}
 };
 
@@ -247,6 +323,7 @@ static void usage_info(const char *cmd)
 	std::cout << "    --global, -g       - Print global symbols (default)" << std::endl;
 	std::cout << "    --local, -l        - Print local symbols" << std::endl;
 	std::cout << "    --all, -a          - Print all symbols" << std::endl;
+	std::cout << "    --format <fmt>     - Output format: text (default), json or ndjson" << std::endl;
 }
 
 static int do_info(const char *cmd, int argc, char **argv)
@@ -294,6 +371,13 @@ static int do_info(const char *cmd, int argc, char **argv)
 			opts.global = opts.local = true;
 			opts.functions = opts.objects = true;
 			break;
+		case OPTION_INFO_FORMAT:
+			if (!parse_format(optarg, opts.format)) {
+				diag() << "Unknown output format: " << optarg << std::endl;
+				usage_info(cmd);
+				return 1;
+			}
+			break;
 		}
 	}
 
@@ -304,7 +388,7 @@ static int do_info(const char *cmd, int argc, char **argv)
 		opts.global = g_cmd;
 
 	if (optind + 1 > argc) {
-		std::cerr << "Error: Filename required" << std::endl;
+		diag() << "Error: Filename required" << std::endl;
 		usage_info(cmd);
 		return 1;
 	}
@@ -321,7 +405,7 @@ static int do_info(const char *cmd, int argc, char **argv)
 	if (opts.fn_name == "")
 		print_symbol_info(filename.c_str(), opts);
 	else
-		print_one_symbol_info(filename.c_str(), opts.fn_name);
+		print_one_symbol_info(filename.c_str(), opts);
 
 	return 0;
 }
@@ -361,7 +445,7 @@ static int do_show(const char *cmd, int argc, char **argv)
 	}
 
 	if (optind + 1 > argc) {
-		std::cerr << "Error: Filename and symbol required" << std::endl;
+		diag() << "Error: Filename and symbol required" << std::endl;
 		usage_show(cmd);
 		return 1;
 	}
@@ -379,7 +463,7 @@ static int do_show(const char *cmd, int argc, char **argv)
 	}
 
 	if (sym == "") {
-		std::cerr << "Error: Symbol name required" << std::endl;
+		diag() << "Error: Symbol name required" << std::endl;
 		usage_show(cmd);
 		return 1;
 	}
@@ -395,6 +479,8 @@ static struct option cg_options[] = {
 	{ "external",	no_argument,		0, OPTION_CG_EXTERNAL		},
 	{ "function",	required_argument,	0, OPTION_CG_FUNCTION		},
 	{ "max-depth",	required_argument,	0, OPTION_CG_MAXDEPTH		},
+	{ "keep-debug",	no_argument,		0, OPTION_CG_KEEP_DEBUG		},
+	{ "format",	required_argument,	0, OPTION_CG_FORMAT		},
 	{ 0,		0,			0, 0				}
 };
 
@@ -403,17 +489,21 @@ static void usage_cg(const char *cmd)
 	std::cout << "Usage: " << cmd << " callgraph [options] file(s)" << std::endl;
 	std::cout << "Options:" << std::endl;
 	std::cout << "    --help, -h            - Print this help message" << std::endl;
-	std::cout << "    --output, -o <file>   - Output filename (default: callgraph.dot)" << std::endl;
+	std::cout << "    --output, -o <file>   - Output filename, - for stdout (default: callgraph.dot," << std::endl;
+	std::cout << "                            stdout for the JSON formats)" << std::endl;
 	std::cout << "    --external, -e        - Include external symbols in call-graph" << std::endl;
 	std::cout << "    --function, -f <name> - Include only symbols reachable from function(s)" << std::endl;
 	std::cout << "    --max-depth <num>     - Limits the maximum call-depth included in the" << std::endl;
 	std::cout << "                            graph when --function is used" << std::endl;
+	std::cout << "    --keep-debug          - Also load .debug_* sections" << std::endl;
+	std::cout << "    --format <fmt>        - Output format: dot (default), json or ndjson" << std::endl;
 }
 
 static int do_callgraph(const char *cmd, int argc, char **argv)
 {
 	struct cg_options opts;
 	std::string filename;
+	bool output = false;
 
 	while (true) {
 		int opt_idx, c;
@@ -430,6 +520,7 @@ static int do_callgraph(const char *cmd, int argc, char **argv)
 		case OPTION_CG_OUTPUT:
 		case 'o':
 			opts.output_file = optarg;
+			output = true;
 			break;
 		case OPTION_CG_EXTERNAL:
 		case 'e':
@@ -442,6 +533,19 @@ static int do_callgraph(const char *cmd, int argc, char **argv)
 		case OPTION_CG_MAXDEPTH:
 			opts.maxdepth = std::max(atoi(optarg), 1);
 			break;
+		case OPTION_CG_KEEP_DEBUG:
+			opts.skip_debug = false;
+			break;
+		case OPTION_CG_FORMAT:
+			if (std::string(optarg) == "dot") {
+				opts.format = output_format::TEXT;
+			} else if (std::string(optarg) == "text" ||
+				   !parse_format(optarg, opts.format)) {
+				diag() << "Unknown output format: " << optarg << std::endl;
+				usage_cg(cmd);
+				return 1;
+			}
+			break;
 		default:
 			usage_cg(cmd);
 			return 1;
@@ -449,7 +553,7 @@ static int do_callgraph(const char *cmd, int argc, char **argv)
 	}
 
 	if (optind + 1 > argc) {
-		std::cerr << "Error: Filename required" << std::endl;
+		diag() << "Error: Filename required" << std::endl;
 		usage_show(cmd);
 		return 1;
 	}
@@ -457,6 +561,9 @@ static int do_callgraph(const char *cmd, int argc, char **argv)
 	while (optind < argc)
 		opts.input_files.emplace_back(argv[optind++]);
 
+	if (!output && opts.format != output_format::TEXT)
+		opts.output_file = "-";
+
 	generate_callgraph(opts);
 
 	return 0;
@@ -464,6 +571,7 @@ static int do_callgraph(const char *cmd, int argc, char **argv)
 
 int main(int argc, char **argv)
 {
+	buffered_stdout output;
 	std::string command;
 	int ret = 0;
 
@@ -488,12 +596,12 @@ int main(int argc, char **argv)
 		else if (command == "help")
 			usage(argv[0]);
 		else {
-			std::cerr << "Unknown sub-command: " << command << std::endl;
+			diag() << "Unknown sub-command: " << command << std::endl;
 			usage(argv[0]);
 			ret = 1;
 		}
 	} catch (std::runtime_error &e) {
-		std::cerr << "Error: " << e.what() << std::endl;
+		diag() << "Error: " << e.what() << std::endl;
 		ret = 1;
 	}
 
@@ -12,11 +12,17 @@
 
 #include <functional>
 #include <algorithm>
+#include <string_view>
 #include <iostream>
 #include <sstream>
-#include <fstream>
+#include <cstring>
+#include <exception>
 #include <vector>
+#include <thread>
 #include <stack>
+#include <unordered_map>
+#include <unordered_set>
+#include <limits>
 #include <map>
 #include <set>
 
@@ -24,10 +30,12 @@
 
 #include "assembly.h"
 #include "helper.h"
+#include "output.h"
+#include "parse-cache.h"
 
 namespace assembly {
 
-	static const struct __stmt_map {
+	static constexpr struct __stmt_map {
 		const char *str;
 		stmt_type type;
 	} stmt_map[] = {
@@ -78,19 +86,153 @@ namespace assembly {
 		{ .str = 0,				.type = stmt_type::NOSTMT		},
 	};
 
+	// Directives are looked up through a perfect hash over stmt_map[].
+	// The seed is searched at compile time so that every directive gets
+	// its own slot in the table.
+	static constexpr size_t stmt_hash_bits = 8;
+	static constexpr size_t stmt_hash_size = 1 << stmt_hash_bits;
+
+	static constexpr uint32_t stmt_hash(const char *str, size_t len, uint32_t seed)
+	{
+		uint32_t hash = seed ^ static_cast<uint32_t>(len);
+
+		for (size_t i = 0; i < len; ++i)
+			hash = (hash ^ static_cast<unsigned char>(str[i])) * 16777619u;
+
+		return (hash ^ (hash >> 15)) & (stmt_hash_size - 1);
+	}
+
+	static constexpr size_t const_strlen(const char *str)
+	{
+		size_t len = 0;
+
+		while (str[len])
+			++len;
+
+		return len;
+	}
+
+	struct stmt_hash_table {
+		uint32_t seed;
+		uint8_t slot[stmt_hash_size];	// Index into stmt_map[] + 1
+	};
+
+	static constexpr bool stmt_hash_try(stmt_hash_table &table, uint32_t seed)
+	{
+		table.seed = seed;
+		for (size_t i = 0; i < stmt_hash_size; ++i)
+			table.slot[i] = 0;
+
+		for (size_t i = 0; stmt_map[i].type != stmt_type::NOSTMT; ++i) {
+			const char *str = stmt_map[i].str;
+			uint32_t h = stmt_hash(str, const_strlen(str), seed);
+
+			if (table.slot[h] != 0)
+				return false;
+
+			table.slot[h] = static_cast<uint8_t>(i + 1);
+		}
+
+		return true;
+	}
+
+	static constexpr stmt_hash_table make_stmt_hash()
+	{
+		stmt_hash_table table {};
+
+		for (uint32_t seed = 2166136261u; !stmt_hash_try(table, seed); ++seed)
+			;
+
+		return table;
+	}
+
+	static constexpr stmt_hash_table stmt_hash_map = make_stmt_hash();
+
+	static enum stmt_type lookup_stmt(std::string_view instr)
+	{
+		// All known directives start with a '.'
+		if (instr.empty() || instr[0] != '.')
+			return stmt_type::NOSTMT;
+
+		uint32_t h = stmt_hash(instr.data(), instr.size(), stmt_hash_map.seed);
+		uint8_t slot = stmt_hash_map.slot[h];
+
+		if (slot == 0 || instr != stmt_map[slot - 1].str)
+			return stmt_type::NOSTMT;
+
+		return stmt_map[slot - 1].type;
+	}
+
+	// Character classes used by the tokenizer. These are plain ASCII
+	// and don't depend on the current locale.
+	enum char_class : uint8_t {
+		CC_IDENTIFIER	= 1 << 0,
+		CC_REGISTER	= 1 << 1,
+		CC_TYPEFLAG	= 1 << 2,
+		CC_NUMBER	= 1 << 3,
+		CC_INSTR	= 1 << 4,
+	};
+
+	struct char_class_table {
+		uint8_t cls[256];
+	};
+
+	static constexpr char_class_table make_char_classes()
+	{
+		char_class_table t {};
+
+		for (int c = 0; c < 256; ++c) {
+			bool digit = (c >= '0' && c <= '9');
+			bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+			bool xdigit = digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+			bool alnum = digit || alpha;
+			uint8_t cls = 0;
+
+			if (alnum || c == '.' || c == '_')
+				cls |= CC_IDENTIFIER;
+			if (alnum || c == '%')
+				cls |= CC_REGISTER;
+			if (alnum || c == '@')
+				cls |= CC_TYPEFLAG;
+			if (xdigit || c == 'x' || c == 'X')
+				cls |= CC_NUMBER;
+			if (alnum || c == '.' || c == '_' || c == '-' || c == ':')
+				cls |= CC_INSTR;
+
+			t.cls[c] = cls;
+		}
+
+		return t;
+	}
+
+	static constexpr char_class_table char_classes = make_char_classes();
+
+	static inline bool char_is(char c, uint8_t cls)
+	{
+		return (char_classes.cls[static_cast<unsigned char>(c)] & cls) != 0;
+	}
+
+	// Local labels generated for debug information, like .LFB0 or .LVL3
+	static bool is_debug_label(const std::string &name)
+	{
+		return name.size() >= 3 && name.compare(0, 2, ".L") == 0 && isalpha(name[2]);
+	}
+
 	template<typename T> bool __ff(T f)
 	{
 		return (static_cast<int>(f) != 0);
 	}
 
 	// Forward declarations
-	static std::vector<std::string> line_to_statements(std::string line);
-	static bool is_valid_symbol(std::string);
-	static bool is_valid_instr_token(std::string);
-	static bool is_identifier_char(char c);
-	static bool is_register_char(char c);
-	static bool is_typeflag_char(char c);
-	static bool is_number_char(char c);
+	static void line_to_statements(const std::vector<std::string_view> &parts,
+				       std::vector<std::string_view> &stmts);
+	static void parse_params(asm_statement&, std::string_view, arena&);
+	static bool is_valid_symbol(const std::string&);
+	static bool is_valid_instr_token(std::string_view);
+	static inline bool is_identifier_char(char c);
+	static inline bool is_register_char(char c);
+	static inline bool is_typeflag_char(char c);
+	static inline bool is_number_char(char c);
 
 	/////////////////////////////////////////////////////////////////////
 	//
@@ -98,7 +240,7 @@ namespace assembly {
 	//
 	/////////////////////////////////////////////////////////////////////
 
-	asm_token::asm_token(std::string token, enum token_type type)
+	asm_token::asm_token(string_id token, enum token_type type)
 		: m_token(token), m_type(type)
 	{
 	}
@@ -111,7 +253,7 @@ namespace assembly {
 		if (m_type == token_type::STRING)
 			os << '"';
 
-		os << m_token;
+		os << string_table::get(m_token);
 
 		if (m_type == token_type::STRING)
 			os << '"';
@@ -126,12 +268,17 @@ namespace assembly {
 		return m_type;
 	}
 
-	std::string asm_token::token() const
+	const std::string& asm_token::token() const
+	{
+		return string_table::get(m_token);
+	}
+
+	string_id asm_token::id() const
 	{
 		return m_token;
 	}
 
-	void asm_token::set(std::string token)
+	void asm_token::set(string_id token)
 	{
 		m_token = token;
 	}
@@ -142,26 +289,35 @@ namespace assembly {
 	//
 	/////////////////////////////////////////////////////////////////////
 
-	template<typename T>
-	void asm_param::add_token(T&& t)
+	asm_param::asm_param(asm_token *tokens, uint32_t count)
+		: m_tokens(tokens), m_count(count)
 	{
-		m_tokens.push_back(std::forward<T>(t));
 	}
 
-	void asm_param::reset()
+	asm_param asm_param::clone(arena &alloc) const
 	{
-		m_tokens.clear();
+		return asm_param(alloc.copy(m_tokens, m_count), m_count);
 	}
 
 	size_t asm_param::tokens() const
 	{
-		return m_tokens.size();
+		return m_count;
+	}
+
+	asm_token& asm_param::token(size_t idx)
+	{
+		return m_tokens[idx];
 	}
 
-	void asm_param::token(asm_param::token_t::size_type idx,
-			      std::function<void(enum token_type, std::string)> handler) const
+	const asm_token& asm_param::token(size_t idx) const
 	{
-		if (m_tokens.size() <= idx)
+		return m_tokens[idx];
+	}
+
+	void asm_param::token(size_t idx,
+			      std::function<void(enum token_type, const std::string&)> handler) const
+	{
+		if (m_count <= idx)
 			return;
 
 		handler(m_tokens[idx].type(), m_tokens[idx].token());
@@ -169,12 +325,12 @@ namespace assembly {
 
 	void asm_param::for_each_token(token_handler handler)
 	{
-		for_each(m_tokens.begin(), m_tokens.end(), handler);
+		std::for_each(m_tokens, m_tokens + m_count, handler);
 	}
 
 	void asm_param::for_each_token(const_token_handler handler) const
 	{
-		for_each(m_tokens.begin(), m_tokens.end(), handler);
+		std::for_each(m_tokens, m_tokens + m_count, handler);
 	}
 
 	std::string asm_param::serialize() const
@@ -182,7 +338,7 @@ namespace assembly {
 		std::ostringstream os;
 		int count = 0;
 
-		for_each(m_tokens.begin(), m_tokens.end(), [&](const asm_token& t) {
+		std::for_each(m_tokens, m_tokens + m_count, [&](const asm_token& t) {
 			if (count++)
 				os << ' ';
 			os << t.serialize();
@@ -197,75 +353,254 @@ namespace assembly {
 	//
 	/////////////////////////////////////////////////////////////////////
 
-	asm_statement::asm_statement(std::string stmt)
-		: m_stmt(std::move(stmt)), m_type(stmt_type::NOSTMT)
+	asm_statement::asm_statement(std::string_view stmt, enum stmt_type type)
+		: m_stmt(stmt), m_instr(0), m_type(type),
+		  m_nparams(0), m_deferred(false), m_params(nullptr), m_comm()
+	{
+		if (type == stmt_type::TYPE)
+			m_symtype.type = symbol_type::UNKNOWN;
+	}
+
+	// Returns the first token of a parameter if it is an identifier
+	string_id asm_statement::param_identifier(size_t idx) const
+	{
+		if (m_nparams <= idx || m_params[idx].tokens() == 0)
+			return 0;
+
+		const asm_token &t = m_params[idx].token(0);
+
+		return t.type() == token_type::IDENTIFIER ? t.id() : 0;
+	}
+
+	static inline void rename(string_id &id, const label_map &labels)
+	{
+		auto it = labels.find(id);
+
+		if (it != labels.end())
+			id = it->second;
+	}
+
+	// Returns the symbol field of TYPE, SIZE, COMM and LABEL statements
+	string_id asm_statement::symbol_field() const
 	{
+		switch (m_type) {
+		case stmt_type::LABEL:
+			return m_instr;
+		case stmt_type::TYPE:
+			return m_symtype.symbol;
+		case stmt_type::SIZE:
+			return m_size.symbol;
+		case stmt_type::COMM:
+			return m_comm.symbol;
+		default:
+			return 0;
+		}
 	}
 
-	void asm_statement::rename_label(std::string from, std::string to)
+	// Returns true if rename_labels() would change this statement
+	bool asm_statement::references(const label_map &labels) const
 	{
-		for_each_param([&from, &to] (asm_param &p) {
-			p.for_each_token([&from, &to] (asm_token &t) {
+		// We don't rename section names
+		if (m_type == stmt_type::SECTION)
+			return false;
+
+		string_id sym = symbol_field();
+		if (sym != 0 && labels.count(sym))
+			return true;
+
+		for (uint32_t idx = 0; idx < m_nparams; ++idx) {
+			const asm_param &p = m_params[idx];
+
+			for (size_t jdx = 0; jdx < p.tokens(); ++jdx) {
+				const asm_token &t = p.token(jdx);
+
+				if (t.type() == token_type::IDENTIFIER && labels.count(t.id()))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	void asm_statement::rename_labels(const label_map &labels)
+	{
+		if (m_type == stmt_type::SECTION)
+			return;
+
+		for (uint32_t idx = 0; idx < m_nparams; ++idx) {
+			asm_param &p = m_params[idx];
+
+			for (size_t jdx = 0; jdx < p.tokens(); ++jdx) {
+				asm_token &t = p.token(jdx);
+
 				if (t.type() != token_type::IDENTIFIER)
-					return;
-				if (t.token() == from)
-					t.set(to);
-			});
-		});
+					continue;
+
+				string_id id = t.id();
+				rename(id, labels);
+				t.set(id);
+			}
+		}
+
+		switch (m_type) {
+		case stmt_type::LABEL:
+			rename(m_instr, labels);
+			break;
+		case stmt_type::TYPE:
+			rename(m_symtype.symbol, labels);
+			break;
+		case stmt_type::SIZE:
+			rename(m_size.symbol, labels);
+			break;
+		case stmt_type::COMM:
+			rename(m_comm.symbol, labels);
+			break;
+		default:
+			break;
+		}
 	}
 
 	void asm_statement::analyze()
 	{
+		switch (m_type) {
+		case stmt_type::TYPE:
+			analyze_type();
+			break;
+		case stmt_type::SIZE:
+			analyze_size();
+			break;
+		case stmt_type::SECTION:
+			analyze_section();
+			break;
+		case stmt_type::COMM:
+			analyze_comm();
+			break;
+		default:
+			break;
+		}
+	}
+
+	void asm_statement::analyze_type()
+	{
+		static const string_id function_id = string_table::intern("@function");
+		static const string_id object_id   = string_table::intern("@object");
+
+		if (m_nparams < 2)
+			return;
+
+		m_symtype.symbol = param_identifier(0);
+
+		if (m_params[1].tokens() == 0)
+			return;
+
+		const asm_token &flag = m_params[1].token(0);
+
+		if (flag.type() == token_type::TYPEFLAG) {
+			if (flag.id() == function_id)
+				m_symtype.type = symbol_type::FUNCTION;
+			else if (flag.id() == object_id)
+				m_symtype.type = symbol_type::OBJECT;
+			else
+				m_symtype.type = symbol_type::UNKNOWN;
+		}
+	}
+
+	void asm_statement::analyze_size()
+	{
+		if (m_nparams < 2)
+			return;
+
+		m_size.symbol = param_identifier(0);
+	}
+
+	void asm_statement::analyze_section()
+	{
+		auto size = m_nparams;
+
+		if (size < 1)
+			return;
+
+		m_section.name = param_identifier(0);
+
+		if (size < 2)
+			return;
+
+		if (m_params[1].tokens() && m_params[1].token(0).type() == token_type::STRING)
+			m_section.flags = m_params[1].token(0).id();
+
+		m_section.executable = (string_table::get(m_section.flags).find_first_of("x") != std::string::npos);
+	}
+
+	void asm_statement::analyze_comm()
+	{
+		auto size = m_nparams;
+
+		if (size < 1)
+			return;
+
+		m_comm.symbol = param_identifier(0);
+
+		if (size < 2)
+			return;
+
+		m_params[1].token(0, [&](enum token_type type, const std::string &token) {
+			if (type == token_type::NUMBER) {
+				std::istringstream is(token);
+
+				is >> m_comm.size;
+			}
+		});
+
+		if (size < 3)
+			return;
+
+		m_params[2].token(0, [&](enum token_type type, const std::string &token) {
+			if (type == token_type::NUMBER) {
+				std::istringstream is(token);
+
+				is >> m_comm.alignment;
+			}
+		});
 	}
 
 	bool asm_statement::operator==(const asm_statement& stmt) const
 	{
 		if (m_type != stmt.m_type   ||
 		    m_instr != stmt.m_instr ||
-		    m_params.size() != stmt.m_params.size())
+		    m_nparams != stmt.m_nparams)
 			return false;
 
-		auto size = m_params.size();
-		auto type = m_type;
-		bool ret = true;
+		// Compiler generated symbols in instructions and data
+		// definitions are considered equal
+		bool generated = (m_type == stmt_type::INSTRUCTION ||
+				  m_type == stmt_type::DATADEF);
+		auto size = m_nparams;
 
 		for (size_t idx = 0; idx < size; ++idx) {
 			auto &p1 = m_params[idx];
 			auto &p2 = stmt.m_params[idx];
 
-			if (!ret)
-				break;
-
 			if (p1.tokens() != p2.tokens())
 				return false;
 
 			for (size_t jdx = 0; jdx < p1.tokens(); ++jdx) {
-				p1.token(jdx, [&jdx, &p2, &type, &ret](enum token_type t1, std::string s1) {
-					p2.token(jdx, [&t1, &s1, &type, &ret](enum token_type t2, std::string s2) {
-						if (t1 != t2) {
-							ret = false;
-							return;
-						}
-
-						ret = (s1 == s2);
+				const asm_token &t1 = p1.token(jdx);
+				const asm_token &t2 = p2.token(jdx);
 
-						if (ret)
-							return;
+				if (t1.type() != t2.type())
+					return false;
 
-						if (((type == stmt_type::INSTRUCTION) ||
-						     (type == stmt_type::DATADEF))    &&
-						    (t1  == token_type::IDENTIFIER))
-							ret = generated_symbol(s1) && generated_symbol(s2);
-
-					});
-				});
+				if (t1.id() == t2.id())
+					continue;
 
-				if (!ret)
-					break;
+				if (!generated || t1.type() != token_type::IDENTIFIER ||
+				    !string_table::generated(t1.id()) ||
+				    !string_table::generated(t2.id()))
+					return false;
 			}
 		}
 
-		return ret;
+		return true;
 	}
 
 	bool asm_statement::operator!=(const asm_statement& stmt) const
@@ -273,9 +608,43 @@ namespace assembly {
 		return !operator==(stmt);
 	}
 
-	void asm_statement::type(enum stmt_type t)
+	static inline uint64_t hash_mix(uint64_t hash, uint64_t value)
+	{
+		hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+
+		return hash;
+	}
+
+	uint64_t asm_statement::hash() const
 	{
-		m_type = t;
+		// Must follow operator==, so all compiler generated symbols
+		// hash the same where they compare equal
+		bool generated = (m_type == stmt_type::INSTRUCTION ||
+				  m_type == stmt_type::DATADEF);
+		uint64_t hash = static_cast<uint64_t>(m_type);
+
+		hash = hash_mix(hash, m_instr);
+		hash = hash_mix(hash, m_nparams);
+
+		for (size_t idx = 0; idx < m_nparams; ++idx) {
+			const asm_param &p = m_params[idx];
+
+			hash = hash_mix(hash, p.tokens());
+
+			for (size_t jdx = 0; jdx < p.tokens(); ++jdx) {
+				const asm_token &t = p.token(jdx);
+				uint64_t id = t.id();
+
+				if (generated && t.type() == token_type::IDENTIFIER &&
+				    string_table::generated(t.id()))
+					id = ~uint64_t(0);
+
+				hash = hash_mix(hash, static_cast<uint64_t>(t.type()));
+				hash = hash_mix(hash, id);
+			}
+		}
+
+		return hash;
 	}
 
 	enum stmt_type asm_statement::type() const
@@ -283,40 +652,83 @@ namespace assembly {
 		return m_type;
 	}
 
-	std::string asm_statement::raw() const
+	std::string_view asm_statement::raw() const
 	{
 		return m_stmt;
 	}
 
-	std::string asm_statement::instr() const
+	const std::string& asm_statement::instr() const
+	{
+		return string_table::get(m_instr);
+	}
+
+	string_id asm_statement::instr_id() const
 	{
 		return m_instr;
 	}
 
-	void asm_statement::set_instr(std::string instr)
+	void asm_statement::set_instr(string_id instr)
 	{
 		m_instr = instr;
 	}
 
-	template<typename T>
-	void asm_statement::add_param(T&& p)
+	void asm_statement::set_params(asm_param *params, uint32_t count)
 	{
-		m_params.push_back(std::forward<T>(p));
+		m_params  = params;
+		m_nparams = count;
 	}
 
-	void asm_statement::param(param_type::size_type idx,
+	// Give this statement private copies of its parameters and tokens,
+	// so they can be modified without affecting the original
+	void asm_statement::clone_params(arena &alloc)
+	{
+		m_params = alloc.copy(m_params, m_nparams);
+
+		for (uint32_t idx = 0; idx < m_nparams; ++idx)
+			m_params[idx] = m_params[idx].clone(alloc);
+	}
+
+	bool asm_statement::deferred() const
+	{
+		return m_deferred;
+	}
+
+	void asm_statement::set_deferred(bool deferred)
+	{
+		m_deferred = deferred;
+	}
+
+	// Tokenize the operands of a deferred statement
+	void asm_statement::tokenize(arena &alloc)
+	{
+		std::string_view instr, params;
+
+		if (!m_deferred)
+			return;
+
+		split_first(" \t", m_stmt, instr, params);
+
+		// Labels already have their name
+		if (m_type != stmt_type::LABEL)
+			m_instr = string_table::intern(instr);
+
+		parse_params(*this, params, alloc);
+		m_deferred = false;
+	}
+
+	void asm_statement::param(size_t idx,
 				  param_handler p)
 	{
-		if (m_params.size() <= idx)
+		if (m_nparams <= idx)
 			return;
 
 		p(m_params[idx]);
 	}
 
-	void asm_statement::param(param_type::size_type idx,
+	void asm_statement::param(size_t idx,
 				  const_param_handler p) const
 	{
-		if (m_params.size() <= idx)
+		if (m_nparams <= idx)
 			return;
 
 		p(m_params[idx]);
@@ -324,37 +736,43 @@ namespace assembly {
 
 	void asm_statement::for_each_param(param_handler handler)
 	{
-		std::for_each(m_params.begin(), m_params.end(), handler);
+		std::for_each(m_params, m_params + m_nparams, handler);
 	}
 
 	void asm_statement::for_each_param(const_param_handler handler) const
 	{
-		std::for_each(m_params.begin(), m_params.end(), handler);
+		std::for_each(m_params, m_params + m_nparams, handler);
 	}
 
 	void asm_statement::map_symbols(symbol_map &map, const asm_statement &stmt) const
 	{
-		auto size = m_params.size();
+		auto size = m_nparams;
 
 		for (size_t idx = 0; idx < size; ++idx) {
 			auto &p1 = m_params[idx];
 			auto &p2 = stmt.m_params[idx];
 
 			for (size_t jdx = 0; jdx < p1.tokens(); ++jdx) {
-				p1.token(jdx, [&jdx, &p2, &map](enum token_type t1, std::string s1) {
-					p2.token(jdx, [&t1, &s1, &map](enum token_type t2, std::string s2) {
-						if ((t1 != token_type::IDENTIFIER) || !generated_symbol(s1))
-							return;
-
-						if (map.find(s1) != map.end() && map[s1] != s2) {
-							std::cerr << "WARNING: Symbol " << s1;
-							std::cerr << " maps to " << map[s1];
-							std::cerr << " and " << s2 << std::endl;
-						} else {
-							map[s1] = s2;
-						}
-					});
-				});
+				const asm_token &t1 = p1.token(jdx);
+
+				if (jdx >= p2.tokens())
+					break;
+
+				if ((t1.type() != token_type::IDENTIFIER) ||
+				    !string_table::generated(t1.id()))
+					continue;
+
+				const std::string &s1 = t1.token();
+				const std::string &s2 = p2.token(jdx).token();
+				auto it = map.find(s1);
+
+				if (it != map.end() && it->second != s2) {
+					diag() << "WARNING: Symbol " << s1
+					       << " maps to " << it->second
+					       << " and " << s2 << std::endl;
+				} else {
+					map[s1] = s2;
+				}
 			}
 		}
 	}
@@ -364,14 +782,14 @@ namespace assembly {
 		std::ostringstream os;
 		int count = 0;
 
-		os << m_instr;
+		os << string_table::get(m_instr);
 
 		if (m_type == stmt_type::LABEL)
 			os << ':';
 		else
 			os << ' ';
 
-		for_each (m_params.begin(), m_params.end(), [&](const asm_param& p) {
+		std::for_each (m_params, m_params + m_nparams, [&](const asm_param& p) {
 			if (count++)
 				os << ',';
 			os << p.serialize();
@@ -380,244 +798,173 @@ namespace assembly {
 		return os.str();
 	}
 
-	std::string asm_statement::statement() const
+	std::string_view asm_statement::statement() const
 	{
 		return m_stmt;
 	}
 
-	/////////////////////////////////////////////////////////////////////
-	//
-	// Class asm_type
-	//
-	/////////////////////////////////////////////////////////////////////
-
-	asm_type::asm_type(std::string stmt)
-		: asm_statement(std::move(stmt))
+	const std::string& asm_statement::get_label() const
 	{
-		m_type = stmt_type::TYPE;
+		return string_table::get(label_id());
 	}
 
-	void asm_type::rename_label(std::string from, std::string to)
+	string_id asm_statement::label_id() const
 	{
-		asm_statement::rename_label(from, to);
-
-		if (m_symbol == from)
-			m_symbol = to;
+		return m_type == stmt_type::LABEL ? m_instr : 0;
 	}
 
-	enum symbol_type asm_type::get_type() const
+	const std::string& asm_statement::get_symbol() const
 	{
-		return m_stype;
+		return string_table::get(symbol_id());
 	}
 
-	std::string asm_type::get_symbol() const
+	string_id asm_statement::symbol_id() const
 	{
-		return m_symbol;
+		switch (m_type) {
+		case stmt_type::TYPE:
+			return m_symtype.symbol;
+		case stmt_type::SIZE:
+			return m_size.symbol;
+		case stmt_type::COMM:
+			return m_comm.symbol;
+		default:
+			return 0;
+		}
 	}
 
-	void asm_type::analyze()
+	enum symbol_type asm_statement::get_symbol_type() const
 	{
-		if (m_params.size() < 2)
-			return;
+		return m_type == stmt_type::TYPE ? m_symtype.type : symbol_type::UNKNOWN;
+	}
 
-		m_params[0].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::IDENTIFIER)
-				m_symbol = token;
-		});
+	const std::string& asm_statement::get_name() const
+	{
+		return string_table::get(m_type == stmt_type::SECTION ? m_section.name : 0);
+	}
 
-		m_params[1].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::TYPEFLAG) {
-				if (token == "@function")
-					m_stype = symbol_type::FUNCTION;
-				else if (token == "@object")
-					m_stype = symbol_type::OBJECT;
-				else
-					m_stype = symbol_type::UNKNOWN;
-			}
-		});
+	bool asm_statement::executable() const
+	{
+		return m_type == stmt_type::SECTION && m_section.executable;
 	}
 
 	/////////////////////////////////////////////////////////////////////
 	//
-	// Class asm_label
+	// Struct asm_symbol
 	//
 	/////////////////////////////////////////////////////////////////////
 
-	asm_label::asm_label(std::string stmt)
-		: asm_statement(stmt)
-	{
-		m_type = stmt_type::LABEL;
-	}
-
-	void asm_label::rename_label(std::string from, std::string to)
-	{
-		asm_statement::rename_label(from, to);
-
-		if (m_instr == from)
-			m_instr = to;
-	}
-
-	std::string asm_label::get_label() const
+	asm_symbol::asm_symbol()
+		: m_idx(0), m_size_idx(0), m_section_idx(0), m_align_idx(0), m_type_idx(0),
+		  m_end_idx(0), m_type(symbol_type::UNKNOWN), m_scope(symbol_scope::UNKNOWN)
 	{
-		return m_instr;
 	}
 
 	/////////////////////////////////////////////////////////////////////
 	//
-	// Class asm_size
+	// Class symbol_table
 	//
 	/////////////////////////////////////////////////////////////////////
 
-	asm_size::asm_size(std::string stmt)
-		: asm_statement(stmt)
+	symbol_table::symbol_table()
+		: m_entries(), m_slots(16, 0)
 	{
-		m_type = stmt_type::SIZE;
 	}
 
-	void asm_size::rename_label(std::string from, std::string to)
+	// Returns the slot holding the name, or the free slot where it
+	// would be inserted
+	size_t symbol_table::slot(string_id name) const
 	{
-		asm_statement::rename_label(from, to);
+		size_t mask = m_slots.size() - 1;
+		size_t idx  = (name * 0x9e3779b97f4a7c15ULL) >> 32;
+
+		for (;; ++idx) {
+			uint32_t s = m_slots[idx & mask];
 
-		if (m_symbol == from)
-			m_symbol = to;
+			if (s == 0 || m_entries[s - 1].first == name)
+				return idx & mask;
+		}
 	}
 
-	void asm_size::analyze()
+	void symbol_table::rehash(size_t size)
 	{
-		if (m_params.size() < 2)
-			return;
+		m_slots.assign(size, 0);
 
-		m_params[0].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::IDENTIFIER)
-				m_symbol = token;
-		});
+		for (size_t idx = 0; idx < m_entries.size(); ++idx)
+			m_slots[slot(m_entries[idx].first)] = idx + 1;
 	}
 
-	std::string asm_size::get_symbol() const
+	asm_symbol& symbol_table::operator[](string_id name)
 	{
-		return m_symbol;
-	}
+		size_t s = slot(name);
 
-	/////////////////////////////////////////////////////////////////////
-	//
-	// Class asm_section
-	//
-	/////////////////////////////////////////////////////////////////////
+		if (m_slots[s] != 0)
+			return m_entries[m_slots[s] - 1].second;
 
-	asm_section::asm_section(std::string stmt)
-		: asm_statement(stmt)
-	{
-		m_type = stmt_type::SECTION;
-	}
+		m_entries.emplace_back(name, asm_symbol());
 
-	void asm_section::rename_label(std::string from, std::string to)
-	{
-		// Do nothing - we don't rename section names
+		// Keep the load factor below 1/2
+		if (m_entries.size() * 2 > m_slots.size())
+			rehash(m_slots.size() * 2);
+		else
+			m_slots[s] = m_entries.size();
+
+		return m_entries.back().second;
 	}
 
-	void asm_section::analyze()
+	const asm_symbol* symbol_table::find(string_id name) const
 	{
-		auto size = m_params.size();
+		uint32_t s = m_slots[slot(name)];
 
-		if (size < 1)
-			return;
-
-		m_params[0].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::IDENTIFIER)
-				m_name = token;
-		});
+		return s ? &m_entries[s - 1].second : nullptr;
+	}
 
-		if (size < 2)
+	void symbol_table::erase(const std::unordered_set<string_id> &names)
+	{
+		if (names.empty())
 			return;
 
-		m_params[1].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::STRING)
-				m_flags = token;
-		});
+		m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+					       [&names](const entry &e) {
+						       return names.count(e.first) != 0;
+					       }),
+				m_entries.end());
 
-		m_executable = (m_flags.find_first_of("x") != std::string::npos);
+		rehash(m_slots.size());
 	}
 
-	std::string asm_section::get_name() const
+	void symbol_table::sort()
 	{
-		return m_name;
-	}
+		std::sort(m_entries.begin(), m_entries.end(),
+			  [](const entry &a, const entry &b) {
+				  return string_table::get(a.first) < string_table::get(b.first);
+			  });
 
-	bool asm_section::executable() const
-	{
-		return m_executable;
+		rehash(m_slots.size());
 	}
 
-	/////////////////////////////////////////////////////////////////////
-	//
-	// Class asm_comm
-	//
-	/////////////////////////////////////////////////////////////////////
-
-	asm_comm::asm_comm(std::string stmt)
-		: asm_statement(stmt), m_symbol(), m_alignment(0), m_size(0)
+	size_t symbol_table::size() const
 	{
-		m_type = stmt_type::COMM;
+		return m_entries.size();
 	}
 
-	void asm_comm::rename_label(std::string from, std::string to)
+	std::vector<symbol_table::entry>::iterator symbol_table::begin()
 	{
-		asm_statement::rename_label(from, to);
-
-		if (m_symbol == from)
-			m_symbol = to;
+		return m_entries.begin();
 	}
 
-	void asm_comm::analyze()
+	std::vector<symbol_table::entry>::iterator symbol_table::end()
 	{
-		auto size = m_params.size();
-
-		if (size < 1)
-			return;
-
-		m_params[0].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::IDENTIFIER)
-				m_symbol = token;
-		});
-
-		if (size < 2)
-			return;
-
-		m_params[1].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::NUMBER) {
-				std::istringstream is(token);
-
-				is >> m_size;
-			}
-		});
-
-		if (size < 3)
-			return;
-
-		m_params[2].token(0, [&](enum token_type type, std::string token) {
-			if (type == token_type::NUMBER) {
-				std::istringstream is(token);
-
-				is >> m_alignment;
-			}
-		});
+		return m_entries.end();
 	}
 
-	std::string asm_comm::get_symbol() const
+	std::vector<symbol_table::entry>::const_iterator symbol_table::begin() const
 	{
-		return m_symbol;
+		return m_entries.begin();
 	}
-
-	/////////////////////////////////////////////////////////////////////
-	//
-	// Struct asm_symbol
-	//
-	/////////////////////////////////////////////////////////////////////
-
-	asm_symbol::asm_symbol()
-		: m_idx(0), m_size_idx(0), m_section_idx(0), m_align_idx(0), m_type_idx(0),
-		  m_type(symbol_type::UNKNOWN), m_scope(symbol_scope::UNKNOWN)
+
+	std::vector<symbol_table::entry>::const_iterator symbol_table::end() const
 	{
+		return m_entries.end();
 	}
 
 	/////////////////////////////////////////////////////////////////////
@@ -627,16 +974,36 @@ namespace assembly {
 	/////////////////////////////////////////////////////////////////////
 
 	asm_object::asm_object(std::string name)
-		: m_name(name)
+		: m_name(name), m_content_hash(0)
+	{
+	}
+
+	void asm_object::add_statement(const asm_statement &stmt)
 	{
+		m_statements.push_back(&stmt);
+		m_hashes.clear();
 	}
 
-	void asm_object::add_statement(const std::unique_ptr<asm_statement> &stmt)
+	// Returns a private copy of a statement that can be changed
+	asm_statement& asm_object::modify(size_t idx)
 	{
-		m_statements.push_back(copy_statement(stmt));
+		m_private.resize(m_statements.size());
+
+		if (!m_private[idx]) {
+			asm_statement *copy = m_arena.create<asm_statement>(*m_statements[idx]);
+
+			copy->clone_params(m_arena);
+			m_statements[idx] = copy;
+			m_private[idx]    = true;
+		}
+
+		// The caller changes the statement
+		m_hashes.clear();
+
+		return const_cast<asm_statement&>(*m_statements[idx]);
 	}
 
-	void asm_object::for_each_statement(std::function<void(asm_statement&)> handler)
+	void asm_object::for_each_statement(std::function<void(const asm_statement&)> handler) const
 	{
 		for (auto it = m_statements.begin(), end = m_statements.end(); it != end; ++it)
 			handler(*(*it));
@@ -649,14 +1016,40 @@ namespace assembly {
 
 	const asm_statement& asm_object::element(diff::size_type idx) const
 	{
-		const asm_statement *ptr = m_statements[idx].get();
+		return *m_statements[idx];
+	}
+
+	void asm_object::update_hashes() const
+	{
+		if (m_hashes.size() == m_statements.size() && !m_statements.empty())
+			return;
+
+		m_hashes.resize(m_statements.size());
+		m_content_hash = 0;
+
+		for (size_t idx = 0; idx < m_statements.size(); ++idx) {
+			m_hashes[idx]  = m_statements[idx]->hash();
+			m_content_hash = (m_content_hash * 0x100000001b3ull) ^ m_hashes[idx];
+		}
+	}
+
+	uint64_t asm_object::hash(diff::size_type idx) const
+	{
+		update_hashes();
+
+		return m_hashes[idx];
+	}
+
+	uint64_t asm_object::content_hash() const
+	{
+		update_hashes();
 
-		return *ptr;
+		return m_content_hash;
 	}
 
 	std::vector<std::string> asm_object::get_symbols() const
 	{
-		std::map<std::string, bool> found;
+		std::unordered_map<string_id, bool> found;
 		std::vector<std::string> symbols;
 
 		// Keep the symbols in a map first to filter out duplicates
@@ -664,10 +1057,8 @@ namespace assembly {
 		     it != end; ++it) {
 
 			if ((*it)->type() == stmt_type::LABEL) {
-				asm_label *label = dynamic_cast<asm_label*>((*it).get());
-
 				// Ignore in-function labels in the symbol-array
-				found[label->get_label()] = false;
+				found[(*it)->instr_id()] = false;
 				continue;
 			}
 
@@ -683,8 +1074,7 @@ namespace assembly {
 						return;
 
 					// Don't overwrite 'false' values
-					if (found.find(t.token()) == found.end())
-						found[t.token()] = true;
+					found.emplace(t.id(), true);
 				});
 			});
 		}
@@ -692,9 +1082,11 @@ namespace assembly {
 		// Now copy the symbols into the vector
 		for (auto it : found) {
 			if (it.second)
-				symbols.push_back(it.first);
+				symbols.push_back(string_table::get(it.first));
 		}
 
+		std::sort(symbols.begin(), symbols.end());
+
 		return symbols;
 	}
 
@@ -708,7 +1100,7 @@ namespace assembly {
 			    (m_statements[i]->type() != stmt_type::DATADEF))
 				continue;
 
-			m_statements[i]->map_symbols(map, *(fn.m_statements[i]));
+			m_statements[i]->map_symbols(map, *fn.m_statements[i]);
 		}
 	}
 
@@ -722,59 +1114,189 @@ namespace assembly {
 	{
 		// We remove label-only symbols, which are labels within
 		// functions
-		std::set<std::string> labels;
+		std::unordered_set<string_id> labels;
 
 		for (auto &sym : m_symbols) {
 			if (sym.second.m_type != symbol_type::FUNCTION)
 				continue;
 
-			auto fn = get_function(sym.first, func_flags::NONE);
-			if (fn == nullptr)
-				continue;
+			for (size_t idx = sym.second.m_idx + 1; idx < sym.second.m_end_idx; ++idx) {
+				const asm_statement &stmt = m_statements[idx];
 
-			fn->for_each_statement([&labels](asm_statement &stmt) {
-				if (stmt.type() != stmt_type::LABEL)
-					return;
+				if (stmt.type() == stmt_type::LABEL)
+					labels.insert(stmt.instr_id());
+			}
+		}
 
-				asm_label *label = dynamic_cast<asm_label*>(&stmt);
-				labels.insert(label->get_label());
-			});
+		m_symbols.erase(labels);
+		m_symbols.sort();
+	}
+
+	// Part of the input file which is not loaded
+	struct text_range {
+		const char	*begin;
+		const char	*end;
+	};
+
+	static bool is_debug_section(std::string_view name)
+	{
+		if (!name.empty() && name[0] == '"')
+			name.remove_prefix(1);
+
+		return name.compare(0, 6, ".debug") == 0;
+	}
+
+	// Finds the contents of debug sections without parsing them. Only
+	// blank lines, labels and plain data definitions are skipped, all
+	// other lines are kept. This includes every line that might change
+	// the section, so the parser still sees those.
+	static std::vector<text_range> find_debug_ranges(std::string_view input)
+	{
+		static const std::string_view data_directives[] = {
+			".byte", ".2byte", ".4byte", ".8byte", ".short", ".value",
+			".long", ".int", ".quad", ".uleb128", ".sleb128", ".string",
+			".ascii", ".asciz", ".zero", ".skip", ".align", ".p2align",
+			".balign",
+		};
+		std::stack<std::pair<bool, bool>> stack;
+		std::vector<text_range> ranges;
+		const char *data  = input.data();
+		const char *limit = data + input.size();
+		const char *start = nullptr;
+		bool debug = false, prev = false;
+
+		while (data < limit) {
+			const char *eol = static_cast<const char*>(memchr(data, '\n', limit - data));
+			bool skip = false;
+
+			eol = (eol == nullptr) ? limit : eol + 1;
+
+			std::string_view line = trim(std::string_view(data, eol - data));
+			size_t pos = 0;
+
+			while (pos < line.size() && is_identifier_char(line[pos]))
+				++pos;
+
+			std::string_view token = line.substr(0, pos);
+			std::string_view rest  = trim(line.substr(pos));
+
+			if (line.empty() || line[0] == '#') {
+				skip = true;
+			} else if (token == ".section" || token == ".pushsection") {
+				std::string_view name;
+
+				split_first(",", rest, name, rest);
+
+				if (token == ".pushsection")
+					stack.push(std::make_pair(debug, prev));
+				prev  = debug;
+				// Don't guess about anything following the directive
+				debug = is_debug_section(name) && line.find(';') == std::string_view::npos;
+			} else if (token == ".text" || token == ".data" || token == ".bss") {
+				prev  = debug;
+				debug = false;
+			} else if (token == ".popsection") {
+				if (stack.empty()) {
+					debug = prev = false;
+				} else {
+					debug = stack.top().first;
+					prev  = stack.top().second;
+					stack.pop();
+				}
+			} else if (token == ".previous") {
+				std::swap(debug, prev);
+			} else if (debug && !token.empty() && rest.size() == 1 && rest[0] == ':') {
+				// Label
+				skip = true;
+			} else if (debug && line.find(';') == std::string_view::npos &&
+				   (rest.empty() || line[pos] == ' ' || line[pos] == '\t') &&
+				   std::find(std::begin(data_directives), std::end(data_directives),
+					     token) != std::end(data_directives)) {
+				skip = true;
+			} else if (debug) {
+				// Something we don't know, it might hide a section change
+				for (auto key : { "sect", ".text", ".data", ".bss", ".previous" }) {
+					if (line.find(key) != std::string_view::npos)
+						debug = false;
+				}
+			}
+
+			skip = skip && debug;
+
+			if (skip && start == nullptr) {
+				start = data;
+			} else if (!skip && start != nullptr) {
+				ranges.push_back({ start, data });
+				start = nullptr;
+			}
+
+			data = eol;
 		}
 
-		for (auto item : labels)
-			m_symbols.erase(item);
+		if (start != nullptr)
+			ranges.push_back({ start, limit });
+
+		return ranges;
 	}
 
-	void asm_file::load()
+	// Statements of one part of the input file, parsed independently
+	struct load_chunk {
+		std::string_view		text;
+		std::vector<asm_statement>	statements;
+		arena				alloc;
+		std::exception_ptr		error;
+	};
+
+	// Don't bother starting threads for chunks smaller than this
+	static const size_t min_chunk_size = 1 << 20;
+
+	static void parse_chunk(load_chunk &chunk, bool deferred,
+				const std::vector<text_range> &skip)
 	{
-		std::ifstream in(m_filename.c_str());
-		std::stack<size_t> sections;
-		std::map<std::string, size_t> first_sec; // Where the section was first seen
-		size_t curr_section_idx = 0;
-		size_t curr_align_idx = 0;
+		std::vector<std::string_view> parts, stmts;
+		std::string buffer;
+
+		const char *data  = chunk.text.data();
+		const char *limit = data + chunk.text.size();
+
+		// Skipped ranges start at line boundaries and may span chunks
+		auto next_skip = std::lower_bound(skip.begin(), skip.end(), data,
+			[](const text_range &r, const char *p) { return r.end <= p; });
+
+		// Most lines hold exactly one statement
+		chunk.statements.reserve(std::count(data, limit, '\n') + 1);
+
+		while (data < limit) {
+			if (next_skip != skip.end() && next_skip->begin <= data) {
+				data = next_skip->end;
+				++next_skip;
+				continue;
+			}
 
-		if (!in.is_open())
-			throw std::runtime_error(std::string("Can't open input file ") + m_filename);
+			const char *eol = static_cast<const char*>(memchr(data, '\n', limit - data));
+			std::string_view line;
 
-		while (!in.eof()) {
-			char buffer[1024];
-			std::string line;
+			if (eol == nullptr)
+				eol = limit;
 
-			in.getline(buffer, 1024);
-			if (in.fail() && !in.eof())
-				throw std::runtime_error("Can't parse input data");
+			line = std::string_view(data, eol - data);
+			data = eol + 1;
 
-			line = trim(strip_comment(buffer));
+			if (!split_statements(line, parts)) {
+				// Lines with C-Style comments are rewritten, keep
+				// them alive as long as the statements
+				line = strip_comment(line, buffer);
+				line = chunk.alloc.copy(line);
+				split_statements(line, parts, false);
+			}
 
-			std::vector<std::string> stmts = line_to_statements(line);
+			line_to_statements(parts, stmts);
 
 			for (auto it = stmts.begin(), end = stmts.end(); it != end; ++it) {
 				// first check for labels
-				bool is_label = true;
-				std::string input;
-				int pos = it->size();
+				size_t pos = it->size();
 
-				for (int i = 0, e = it->size(); i != e && is_label; ++i) {
+				for (size_t i = 0, e = it->size(); i != e; ++i) {
 					if (!(is_identifier_char((*it)[i]) || (*it)[i] == ':'))
 						break;
 
@@ -784,274 +1306,475 @@ namespace assembly {
 					}
 				}
 
-				input = it->substr(0, pos);
-				*it   = it->substr(pos);
-
-				std::unique_ptr<asm_statement> stmt = parse_statement(input);
-				if (stmt == nullptr)
+				asm_statement stmt = parse_statement(it->substr(0, pos), chunk.alloc, deferred);
+				if (stmt.type() == stmt_type::NOSTMT)
 					continue;
 
-				if (stmt->type() == stmt_type::LABEL) {
-					asm_label *label = dynamic_cast<asm_label*>(stmt.get());
-					std::string name = label->get_label();
-
-					// Symbols starting with '.' have local scope only
-					if (is_valid_symbol(name)) {
-						m_symbols[name].m_idx         = m_statements.size();
-						m_symbols[name].m_section_idx = curr_section_idx;
-						if (curr_align_idx)
-							m_symbols[name].m_align_idx = curr_align_idx;
-						if (m_symbols[name].m_scope == symbol_scope::UNKNOWN &&
-						    name[0] != '.')
-							m_symbols[name].m_scope = symbol_scope::GLOBAL;
-						if (m_symbols[name].m_scope == symbol_scope::UNKNOWN &&
-						    name[0] == '.')
-							m_symbols[name].m_scope = symbol_scope::LOCAL;
-						if (m_symbols[name].m_type == symbol_type::UNKNOWN)
-							m_symbols[name].m_type = symbol_type::OBJECT;
-					}
-				} else if (stmt->type() == stmt_type::COMM) {
-					asm_comm *comm = dynamic_cast<asm_comm*>(stmt.get());
-					std::string name = comm->get_symbol();
-
-					if (is_valid_symbol(name)) {
-						m_symbols[name].m_idx         = m_statements.size();
-						m_symbols[name].m_section_idx = curr_section_idx;
-						m_symbols[name].m_type        = symbol_type::OBJECT;
-						if (curr_align_idx)
-							m_symbols[name].m_align_idx = curr_align_idx;
-						if (m_symbols[name].m_scope == symbol_scope::UNKNOWN)
-							m_symbols[name].m_scope = symbol_scope::GLOBAL;
-					}
-					// .comm statements change location pointer
-					curr_align_idx = 0;
-				} else if (stmt->type() == stmt_type::TYPE) {
-					asm_type *type = dynamic_cast<asm_type*>(stmt.get());
-					std::string symbol(type->get_symbol());
-
-					if (symbol.size() != 0) {
-						m_symbols[symbol].m_type = type->get_type();
-						m_symbols[symbol].m_type_idx = m_statements.size();
-						if (m_symbols[symbol].m_scope == symbol_scope::UNKNOWN) {
-							if (symbol[0] == '.')
-								m_symbols[symbol].m_scope = symbol_scope::LOCAL;
-							else
-								m_symbols[symbol].m_scope = symbol_scope::GLOBAL;
-						}
-					}
-				} else if (stmt->type() == stmt_type::LOCAL ||
-					   stmt->type() == stmt_type::GLOBAL) {
-					std::string symbol;
-
-					stmt->param(0, [&symbol](asm_param& p) {
-						p.token(0, [&symbol](enum token_type t, std::string s) {
-							if (t == token_type::IDENTIFIER)
-								symbol = s;
-						});
-					});
-
-					if (symbol != "") {
-						m_symbols[symbol].m_scope =
-							stmt->type() == stmt_type::LOCAL ?
-							symbol_scope::LOCAL :
-							symbol_scope::GLOBAL;
-					}
-				} else if (stmt->type() == stmt_type::SIZE) {
-					asm_size *size = dynamic_cast<asm_size*>(stmt.get());
-					std::string symbol(size->get_symbol());
-
-					m_symbols[symbol].m_size_idx = m_statements.size();
-				} else if (stmt->type() == stmt_type::TEXT ||
-					   stmt->type() == stmt_type::DATA ||
-					   stmt->type() == stmt_type::BSS  ||
-					   stmt->type() == stmt_type::SECTION) {
-					if (stmt->type() == stmt_type::SECTION) {
-						asm_section *sec = dynamic_cast<asm_section*>(stmt.get());
-						std::string secname = sec->get_name();
-
-						if (first_sec.find(secname) == first_sec.end())
-							first_sec[secname] = m_statements.size();
-
-						curr_section_idx = first_sec[secname];
-					} else {
-						curr_section_idx = m_statements.size();
-					}
-				} else if (stmt->type() == stmt_type::PUSHSECTION) {
-					sections.push(curr_section_idx);
-				} else if (stmt->type() == stmt_type::POPSECTION) {
-					if (sections.empty()) {
-						std::cerr << "Warning: .popsection on empty stack" << std::endl;
-					} else {
-						curr_section_idx = sections.top();
-						sections.pop();
-					}
-				} else if (stmt->type() == stmt_type::ALIGN) {
-					curr_align_idx = m_statements.size();
-				} else {
-					curr_align_idx = 0;
+				chunk.statements.push_back(stmt);
+			}
+		}
+	}
+
+	// Split input at line boundaries into at most 'count' chunks
+	static std::vector<load_chunk> split_input(std::string_view input, size_t count)
+	{
+		std::vector<load_chunk> chunks;
+		size_t chunk_size = input.size() / count;
+
+		while (!input.empty()) {
+			size_t pos = std::string_view::npos;
+
+			if (chunks.size() + 1 < count)
+				pos = input.find('\n', chunk_size);
+
+			pos = (pos == std::string_view::npos) ? input.size() : pos + 1;
+
+			chunks.emplace_back();
+			chunks.back().text = input.substr(0, pos);
+			input = input.substr(pos);
+		}
+
+		return chunks;
+	}
+
+	void asm_file::load(enum load_flags flags, unsigned threads_max)
+	{
+		std::vector<std::thread> threads;
+		std::vector<text_range> skip;
+		size_t count;
+
+		m_lazy = __ff(flags & load_flags::LAZY);
+
+		m_input.open(m_filename);
+
+		parse_cache cache(*this, flags);
+
+		if (cache.load()) {
+			diag() << m_warnings;
+			return;
+		}
+
+		if (__ff(flags & load_flags::SKIP_DEBUG))
+			skip = find_debug_ranges(m_input.view());
+
+		count = threads_max ? threads_max : std::thread::hardware_concurrency();
+		count = std::max<size_t>(count, 1);
+		count = std::max<size_t>(std::min(count, m_input.size() / min_chunk_size), 1);
+
+		// Tokenize all chunks in parallel, the first one on this thread
+		std::vector<load_chunk> chunks = split_input(m_input.view(), count);
+
+		for (size_t i = 1; i < chunks.size(); ++i) {
+			threads.emplace_back([this, &chunks, &skip, i] {
+				try {
+					parse_chunk(chunks[i], m_lazy, skip);
+				} catch (...) {
+					chunks[i].error = std::current_exception();
 				}
+			});
+		}
+
+		if (!chunks.empty()) {
+			try {
+				parse_chunk(chunks[0], m_lazy, skip);
+			} catch (...) {
+				chunks[0].error = std::current_exception();
+			}
+		}
+
+		for (auto &t : threads)
+			t.join();
 
-				m_statements.push_back(std::move(stmt));
+		size_t total = 0;
+
+		for (auto &chunk : chunks) {
+			if (chunk.error)
+				std::rethrow_exception(chunk.error);
+
+			total += chunk.statements.size();
+		}
+
+		if (chunks.size() == 1) {
+			m_statements = std::move(chunks[0].statements);
+		} else {
+			m_statements.reserve(total);
+			for (auto &chunk : chunks) {
+				m_statements.insert(m_statements.end(),
+						    chunk.statements.begin(), chunk.statements.end());
+				std::vector<asm_statement>().swap(chunk.statements);
 			}
 		}
 
+		for (auto &chunk : chunks)
+			m_arena.splice(std::move(chunk.alloc));
+
+		analyze_statements();
 		cleanup_symbol_table();
+
+		diag() << m_warnings;
+
+		cache.store();
+	}
+
+	// Data, debug information and labels other than debug labels may
+	// be part of an object
+	static bool object_statement(const asm_statement &stmt)
+	{
+		switch (stmt.type()) {
+		case stmt_type::DOTFILE:
+		case stmt_type::LOC:
+		case stmt_type::DATADEF:
+			return true;
+		case stmt_type::LABEL:
+			return !is_debug_label(stmt.get_label());
+		default:
+			return false;
+		}
+	}
+
+	// A function ends at its .size statement
+	size_t asm_file::function_end(size_t start, string_id name) const
+	{
+		for (; start < m_statements.size(); ++start) {
+			const asm_statement &stmt = m_statements[start];
+
+			if (stmt.type() == stmt_type::SIZE && stmt.symbol_id() == name)
+				break;
+		}
+
+		return start;
+	}
+
+	// An object ends at the first statement which can't be part of it
+	size_t asm_file::object_end(size_t start) const
+	{
+		while (start < m_statements.size() && object_statement(m_statements[start]))
+			++start;
+
+		return start;
+	}
+
+	// Replay section, alignment and symbol bookkeeping over the
+	// statements in file order
+	void asm_file::analyze_statements()
+	{
+		std::map<std::string, size_t> first_sec; // Where the section was first seen
+		std::stack<size_t> sections;
+		size_t curr_section_idx = 0;
+		size_t curr_align_idx = 0;
+		size_t count = m_statements.size();
+
+		// Extents of symbols defined by labels are recorded on the way.
+		// Functions stay open until their .size, objects until the first
+		// statement that can't be part of an object. Both are tracked
+		// for every label, the symbol type is only known at the end.
+		static const size_t open = std::numeric_limits<size_t>::max();
+		std::vector<std::pair<string_id, size_t>> objects;
+		std::vector<size_t> open_objects;
+
+		for (size_t idx = 0; idx < count; ++idx) {
+			const asm_statement &stmt = m_statements[idx];
+
+			if (!open_objects.empty() && !object_statement(stmt)) {
+				for (auto obj : open_objects)
+					objects[obj].second = idx;
+				open_objects.clear();
+			}
+
+			if (stmt.type() == stmt_type::LABEL) {
+				const std::string &name = stmt.get_label();
+
+				// Symbols starting with '.' have local scope only
+				if (is_valid_symbol(name)) {
+					asm_symbol &sym = m_symbols[stmt.label_id()];
+
+					sym.m_end_idx = open;
+					open_objects.push_back(objects.size());
+					objects.emplace_back(stmt.label_id(), count);
+
+					sym.m_idx         = idx;
+					sym.m_section_idx = curr_section_idx;
+					if (curr_align_idx)
+						sym.m_align_idx = curr_align_idx;
+					if (sym.m_scope == symbol_scope::UNKNOWN &&
+					    name[0] != '.')
+						sym.m_scope = symbol_scope::GLOBAL;
+					if (sym.m_scope == symbol_scope::UNKNOWN &&
+					    name[0] == '.')
+						sym.m_scope = symbol_scope::LOCAL;
+					if (sym.m_type == symbol_type::UNKNOWN)
+						sym.m_type = symbol_type::OBJECT;
+				}
+			} else if (stmt.type() == stmt_type::COMM) {
+				const std::string &name = stmt.get_symbol();
+
+				if (is_valid_symbol(name)) {
+					asm_symbol &sym = m_symbols[stmt.symbol_id()];
+
+					sym.m_idx         = idx;
+					sym.m_section_idx = curr_section_idx;
+					sym.m_type        = symbol_type::OBJECT;
+					if (curr_align_idx)
+						sym.m_align_idx = curr_align_idx;
+					if (sym.m_scope == symbol_scope::UNKNOWN)
+						sym.m_scope = symbol_scope::GLOBAL;
+				}
+				// .comm statements change location pointer
+				curr_align_idx = 0;
+			} else if (stmt.type() == stmt_type::TYPE) {
+				const std::string &symbol = stmt.get_symbol();
+
+				if (symbol.size() != 0) {
+					asm_symbol &sym = m_symbols[stmt.symbol_id()];
+
+					sym.m_type = stmt.get_symbol_type();
+					sym.m_type_idx = idx;
+					if (sym.m_scope == symbol_scope::UNKNOWN) {
+						if (symbol[0] == '.')
+							sym.m_scope = symbol_scope::LOCAL;
+						else
+							sym.m_scope = symbol_scope::GLOBAL;
+					}
+				}
+			} else if (stmt.type() == stmt_type::LOCAL ||
+				   stmt.type() == stmt_type::GLOBAL) {
+				string_id symbol = 0;
+
+				stmt.param(0, [&symbol](const asm_param& p) {
+					if (p.tokens() != 0 &&
+					    p.token(0).type() == token_type::IDENTIFIER)
+						symbol = p.token(0).id();
+				});
+
+				if (symbol != 0) {
+					m_symbols[symbol].m_scope =
+						stmt.type() == stmt_type::LOCAL ?
+						symbol_scope::LOCAL :
+						symbol_scope::GLOBAL;
+				}
+			} else if (stmt.type() == stmt_type::SIZE) {
+				asm_symbol &sym = m_symbols[stmt.symbol_id()];
+
+				sym.m_size_idx = idx;
+
+				if (sym.m_end_idx == open)
+					sym.m_end_idx = idx;
+			} else if (stmt.type() == stmt_type::TEXT ||
+				   stmt.type() == stmt_type::DATA ||
+				   stmt.type() == stmt_type::BSS  ||
+				   stmt.type() == stmt_type::SECTION) {
+				if (stmt.type() == stmt_type::SECTION) {
+					const std::string &secname = stmt.get_name();
+
+					if (first_sec.find(secname) == first_sec.end())
+						first_sec[secname] = idx;
+
+					curr_section_idx = first_sec[secname];
+				} else {
+					curr_section_idx = idx;
+				}
+			} else if (stmt.type() == stmt_type::PUSHSECTION) {
+				sections.push(curr_section_idx);
+			} else if (stmt.type() == stmt_type::POPSECTION) {
+				if (sections.empty()) {
+					m_warnings += "Warning: .popsection on empty stack\n";
+				} else {
+					curr_section_idx = sections.top();
+					sections.pop();
+				}
+			} else if (stmt.type() == stmt_type::ALIGN) {
+				curr_align_idx = idx;
+			} else {
+				curr_align_idx = 0;
+			}
+		}
+
+		// The last label of a symbol wins
+		for (auto &obj : objects) {
+			asm_symbol &sym = m_symbols[obj.first];
+
+			if (sym.m_type != symbol_type::FUNCTION)
+				sym.m_end_idx = obj.second;
+		}
+
+		for (auto &item : m_symbols) {
+			asm_symbol &sym = item.second;
+
+			if (sym.m_idx < count && m_statements[sym.m_idx].type() == stmt_type::COMM)
+				sym.m_end_idx = sym.m_idx + 1;
+			else if (sym.m_end_idx == open)
+				sym.m_end_idx = count;
+			else if (sym.m_end_idx != 0)
+				continue;
+			// Symbols without a label have no recorded extent
+			else if (sym.m_type == symbol_type::FUNCTION)
+				sym.m_end_idx = function_end(sym.m_idx + 1, item.first);
+			else
+				sym.m_end_idx = object_end(sym.m_idx + 1);
+		}
+	}
+
+	// Make sure all statements in [start, end) have their operands
+	// tokenized
+	void asm_file::tokenize(size_t start, size_t end) const
+	{
+		if (!m_lazy)
+			return;
+
+		std::lock_guard<std::mutex> lock(*m_lazy_lock);
+
+		for (size_t idx = start; idx < end; ++idx)
+			m_statements[idx].tokenize(m_lazy_arena);
 	}
 
 	const asm_statement& asm_file::stmt(unsigned idx) const
 	{
-		return *m_statements[idx];
+		return m_statements[idx];
+	}
+
+	void asm_file::for_each_symbol(std::function<void(const std::string&, const asm_symbol&)> handler) const
+	{
+		for (auto &item : m_symbols)
+			handler(string_table::get(item.first), item.second);
 	}
 
-	void asm_file::for_each_symbol(std::function<void(std::string, asm_symbol)> handler)
+	const asm_symbol* asm_file::find_symbol(std::string_view symbol) const
 	{
-		for (auto it = m_symbols.begin(), end = m_symbols.end(); it != end; ++it)
-			handler(it->first, it->second);
+		string_id id;
+
+		// Names which were never interned can't be in the table
+		if (!string_table::lookup(symbol, id))
+			return nullptr;
+
+		return m_symbols.find(id);
 	}
 
-	bool asm_file::has_symbol(std::string symbol) const
+	bool asm_file::has_symbol(const std::string &symbol) const
 	{
-		return m_symbols.find(symbol) != m_symbols.end();
+		return find_symbol(symbol) != nullptr;
 	}
 
-	const asm_symbol& asm_file::get_symbol(std::string symbol) const
+	const asm_symbol& asm_file::get_symbol(const std::string &symbol) const
 	{
-		auto s = m_symbols.find(symbol);
+		const asm_symbol *s = find_symbol(symbol);
 
-		if (s == m_symbols.end())
+		if (s == nullptr)
 			throw std::runtime_error("No such symbol: " + symbol);
 
-		return s->second;
+		return *s;
 	}
 
-	bool asm_file::has_function(std::string symbol) const
+	bool asm_file::has_function(const std::string &symbol) const
 	{
-		auto it = m_symbols.find(symbol);
-		if (it == m_symbols.end())
-			return false;
+		const asm_symbol *s = find_symbol(symbol);
 
-		return (it->second.m_type == symbol_type::FUNCTION);
+		return s != nullptr && s->m_type == symbol_type::FUNCTION;
 	}
 
-	std::unique_ptr<asm_object> asm_file::get_function(std::string name, enum func_flags flags) const
+	std::unique_ptr<asm_object> asm_file::get_function(const std::string &name, enum func_flags flags) const
 	{
 		std::unique_ptr<asm_object> fn(nullptr);
+		const asm_symbol *sym = find_symbol(name);
 
-		if (!has_function(name))
+		if (sym == nullptr || sym->m_type != symbol_type::FUNCTION)
 			return fn;
 
 		fn = std::unique_ptr<asm_object>(new asm_object(name));
 
-		auto it_sym = m_symbols.find(name);
-		auto it     = m_statements.begin() + it_sym->second.m_idx + 1;
+		auto start  = sym->m_idx + 1;
+		auto stop   = sym->m_end_idx;
 
-		for (auto end = m_statements.end(); it != end; ++it) {
-			if ((*it)->type() == stmt_type::SIZE) {
-				asm_size *size = dynamic_cast<asm_size*>(it->get());
-				if (size->get_symbol() == name)
-					break;
-			}
+		tokenize(start, stop);
 
+		auto it  = m_statements.begin() + start;
+		auto end = m_statements.begin() + stop;
+
+		for (; it != end; ++it) {
 			if (__ff(flags & func_flags::STRIP_DEBUG)) {
-				if ((*it)->type() == stmt_type::DOTFILE)
+				if (it->type() == stmt_type::DOTFILE)
 					continue;
-				if ((*it)->type() == stmt_type::LOC)
+				if (it->type() == stmt_type::LOC)
+					continue;
+				if (it->type() == stmt_type::LABEL && is_debug_label(it->get_label()))
 					continue;
-				if ((*it)->type() == stmt_type::LABEL) {
-					asm_label *label = dynamic_cast<asm_label*>(it->get());
-					std::string name = label->get_label();
-
-					if (name.size() >= 3 && name.substr(0, 2) == ".L" && isalpha(name[2]))
-						continue;
-				}
 			}
 
 			fn->add_statement(*it);
 		}
 
 		if (__ff(flags & func_flags::NORMALIZE)) {
-			std::map<std::string, std::string> symbols;
+			label_map symbols;
 			int counter = 0;
 
 			// Generate map of replacement symbols
-			fn->for_each_statement([&symbols, &counter](asm_statement& stmt) {
+			for (size_t idx = 0; idx < fn->elements(); ++idx) {
+				const asm_statement &stmt = fn->element(idx);
+
 				if (stmt.type() != stmt_type::LABEL)
-					return;
+					continue;
 
-				asm_label *label = dynamic_cast<asm_label*>(&stmt);
-				std::string name = label->get_label();
+				const std::string &name = stmt.get_label();
 
 				// Only replace symbols generated by the compiler
-				if ((name.size() > 2) && (name.substr(0, 2) != ".L"))
-					return;
+				if ((name.size() > 2) && (name.compare(0, 2, ".L") != 0))
+					continue;
 
 				// Generate the replacement symbol and put in into the map
-				std::ostringstream os;
-				os << "~ASMTOOL" << counter++;
+				std::string repl = "~ASMTOOL" + std::to_string(counter++);
 
-				symbols[name] = os.str();
-			});
+				symbols[stmt.label_id()] = string_table::intern(repl);
+			}
 
-			// Now do the replacement
-			for (auto it = symbols.begin(), end = symbols.end(); it != end; ++it) {
-				fn->for_each_statement([&it](asm_statement& stmt) {
-					stmt.rename_label(it->first, it->second);
-				});
+			// Now do the replacement in a single pass, on private
+			// copies of the statements that change
+			if (!symbols.empty()) {
+				for (size_t idx = 0; idx < fn->elements(); ++idx) {
+					if (fn->element(idx).references(symbols))
+						fn->modify(idx).rename_labels(symbols);
+				}
 			}
 		}
 
 		return fn;
 	}
 
-	bool asm_file::has_object(std::string name) const
+	bool asm_file::has_object(const std::string &name) const
 	{
-		auto it = m_symbols.find(name);
-		if (it == m_symbols.end())
-			return false;
+		const asm_symbol *s = find_symbol(name);
 
-		return (it->second.m_type == symbol_type::OBJECT);
+		return s != nullptr && s->m_type == symbol_type::OBJECT;
 	}
 
-	std::unique_ptr<asm_object> asm_file::get_object(std::string name, enum func_flags flags) const
+	std::unique_ptr<asm_object> asm_file::get_object(const std::string &name, enum func_flags flags) const
 	{
 		std::unique_ptr<asm_object> obj(nullptr);
+		const asm_symbol *sym = find_symbol(name);
 
-		if (!has_object(name))
+		if (sym == nullptr || sym->m_type != symbol_type::OBJECT)
 			return obj;
 
 		obj = std::unique_ptr<asm_object>(new asm_object(name));
 
-		auto it_sym = m_symbols.find(name);
-		auto it     = m_statements.begin() + it_sym->second.m_idx;
-		auto end    = m_statements.end();
+		auto start  = sym->m_idx;
 
-		if ((*it)->type() == stmt_type::COMM) {
-			obj->add_statement(*it);
+		if (m_statements[start].type() == stmt_type::COMM) {
+			obj->add_statement(m_statements[start]);
 			return obj;
 		}
 
 		// Not a .comm object, jump over the label
-		for (it += 1; it != end; it++) {
-			auto type = (*it)->type();
-
-			// Allow debug and datadef statements in objects
-			if (type != stmt_type::DOTFILE && type != stmt_type::LOC &&
-			    type != stmt_type::LABEL   && type != stmt_type::DATADEF)
-				break;
+		auto stop = sym->m_end_idx;
 
-			if (type == stmt_type::LABEL) {
-				// Is it a debug label? Break if not.
-				asm_label *label = dynamic_cast<asm_label*>(it->get());
-				std::string name = label->get_label();
+		start += 1;
+		tokenize(start, stop);
 
-				if (name.size() >= 3 && name.substr(0, 2) == ".L" && isalpha(name[2]))
-					break;
-			}
+		for (auto idx = start; idx < stop; ++idx) {
+			const asm_statement &stmt = m_statements[idx];
 
-			if (type != stmt_type::DATADEF && __ff(flags & func_flags::STRIP_DEBUG))
+			if (stmt.type() != stmt_type::DATADEF && __ff(flags & func_flags::STRIP_DEBUG))
 				continue;
 
-			obj->add_statement(*it);
+			obj->add_statement(stmt);
 		}
 
 		return obj;
@@ -1063,38 +1786,33 @@ namespace assembly {
 	//
 	/////////////////////////////////////////////////////////////////////
 
-	static std::vector<std::string> line_to_statements(std::string line)
+	static void line_to_statements(const std::vector<std::string_view> &parts,
+				       std::vector<std::string_view> &stmts)
 	{
-		std::vector<std::string> split, ret;
+		stmts.clear();
 
-		split = split_trim(";", line);
-
-		for (auto it = split.begin(), end = split.end(); it != end; ++it) {
+		for (auto curr : parts) {
 			// Now check for labels in front of statements;
-			while (*it != "") {
-				std::string input, curr = *it;
-				int pos = curr.size();
-
+			while (!curr.empty()) {
+				size_t pos = curr.size();
 
-				for (int i = 0, e = curr.size(); i != e; ++i) {
+				for (size_t i = 0, e = curr.size(); i != e; ++i) {
 					if (!(is_identifier_char(curr[i]) || curr[i] == ':'))
 						break;
 
-					if ((*it)[i] == ':') {
+					if (curr[i] == ':') {
 						pos = i + 1;
 						break;
 					}
 				}
 
-				ret.push_back(trim(it->substr(0, pos)));
-				*it   = it->substr(pos);
+				stmts.push_back(trim(curr.substr(0, pos)));
+				curr = curr.substr(pos);
 			}
 		}
-
-		return ret;
 	}
 
-	static bool is_valid_symbol(std::string symbol)
+	static bool is_valid_symbol(const std::string &symbol)
 	{
 		if (symbol.size() == 0)
 			return false;
@@ -1102,74 +1820,83 @@ namespace assembly {
 		return !isdigit(symbol[0]);
 	}
 
-	static bool is_valid_instr_token(std::string t)
+	static bool is_valid_instr_token(std::string_view t)
 	{
 		for (auto c : t) {
-			if (!isalnum(c) && c != '.' && c != '_' && c != '-' && c != ':')
+			if (!char_is(c, CC_INSTR))
 				return false;
 		}
 
 		return true;
 	}
 
-	static bool is_identifier_char(char c)
+	static inline bool is_identifier_char(char c)
 	{
-		return (c == '.' || c == '_'  || isalnum(c));
+		return char_is(c, CC_IDENTIFIER);
 	}
 
-	static bool is_register_char(char c)
+	static inline bool is_register_char(char c)
 	{
-		return (c == '%' || isalnum(c));
+		return char_is(c, CC_REGISTER);
 	}
 
-	static bool is_typeflag_char(char c)
+	static inline bool is_typeflag_char(char c)
 	{
-		return (c == '@' || isalnum(c));
+		return char_is(c, CC_TYPEFLAG);
 	}
 
-	static bool is_number_char(char c)
+	static inline bool is_number_char(char c)
 	{
-		return (c == 'x' || c == 'X' || isxdigit(c));
+		return char_is(c, CC_NUMBER);
 	}
 
-	std::unique_ptr<asm_statement> parse_statement(std::string stmt)
+	// Statements which need their operands to build the symbol table
+	static bool symbol_directive(enum stmt_type type)
 	{
-		std::unique_ptr<asm_statement> statement;
-		enum stmt_type stmt_t = stmt_type::NOSTMT;
-		std::string instr, params;
-
-		{
-			std::vector<std::string> items(split_trim(" \t", stmt, 1));
-			auto size = items.size();
-
-			if (size == 0)
-				return statement;
-
-			instr = items[0];
-
-			if (size > 1)
-				params = items[1];
-
-			// Destroy items now
+		switch (type) {
+		case stmt_type::TYPE:
+		case stmt_type::SIZE:
+		case stmt_type::SECTION:
+		case stmt_type::COMM:
+		case stmt_type::GLOBAL:
+		case stmt_type::LOCAL:
+			return true;
+		default:
+			return false;
 		}
+	}
 
-		// Sanity check
-		if (instr.size() == 0)
-			return statement;
-
-		if (!is_valid_instr_token(instr))
-			throw std::runtime_error("Invalid input data");
+	asm_statement parse_statement(std::string_view stmt, arena &alloc, bool deferred)
+	{
+		enum stmt_type stmt_t = stmt_type::NOSTMT;
+		std::string_view instr, params;
+		size_t pos = 0;
+
+		// Fast path: a valid instruction token followed by a blank or
+		// the end of the statement. Everything else takes the slow path.
+		while (pos < stmt.size() && char_is(stmt[pos], CC_INSTR))
+			++pos;
+
+		if (pos > 0 && (pos == stmt.size() || stmt[pos] == ' ' || stmt[pos] == '\t')) {
+			instr = stmt.substr(0, pos);
+			if (pos < stmt.size())
+				params = trim(stmt.substr(pos + 1));
+		} else {
+			split_first(" \t", stmt, instr, params);
+
+			// Sanity check
+			if (instr.size() == 0)
+				return asm_statement(stmt, stmt_t);
+
+			if (!is_valid_instr_token(instr))
+				throw std::runtime_error("Invalid input data");
+		}
 
 		// Find out the type of the statement now
 
 		// First check against the map of known statements, if there is
 		// no match it could be a lable or an instruction
-		for (auto map = stmt_map; map->type != stmt_type::NOSTMT; map++) {
-			if (instr == map->str) {
-				stmt_t = map->type;
-				break;
-			}
-		}
+		stmt_t = lookup_stmt(instr);
 
 		// Now check for instructions and labels, in case we don't know
 		// the type yet
@@ -1177,7 +1904,7 @@ namespace assembly {
 			auto last = instr.rbegin();
 
 			if (*last == ':') {
-				instr.pop_back();
+				instr.remove_suffix(1);
 				stmt_t = stmt_type::LABEL;
 			} else if (instr[0] == '.') {
 				stmt_t = stmt_type::UNKNOWN;
@@ -1186,87 +1913,83 @@ namespace assembly {
 			}
 		}
 
-		switch (stmt_t) {
-		case stmt_type::TYPE:
-			statement = std::unique_ptr<asm_statement>(new asm_type(stmt));
-			break;
-		case stmt_type::LABEL:
-			statement = std::unique_ptr<asm_statement>(new asm_label(stmt));
-			break;
-		case stmt_type::SIZE:
-			statement = std::unique_ptr<asm_statement>(new asm_size(stmt));
-			break;
-		case stmt_type::SECTION:
-			statement = std::unique_ptr<asm_statement>(new asm_section(stmt));
-			break;
-		case stmt_type::COMM:
-			statement = std::unique_ptr<asm_statement>(new asm_comm(stmt));
-			break;
-		default:
-			statement = std::unique_ptr<asm_statement>(new asm_statement(stmt));
-			break;
+		asm_statement statement(stmt, stmt_t);
+
+		// Labels are needed for the symbol table even when deferred
+		if (deferred && !symbol_directive(stmt_t)) {
+			if (stmt_t == stmt_type::LABEL)
+				statement.set_instr(string_table::intern(instr));
+			statement.set_deferred(true);
+			return statement;
 		}
 
-		statement->type(stmt_t);
-		statement->set_instr(instr);
+		statement.set_instr(string_table::intern(instr));
+		parse_params(statement, params, alloc);
+
+		return statement;
+	}
+
+	static void parse_params(asm_statement &statement, std::string_view params, arena &alloc)
+	{
+		// Tokens and parameter boundaries are collected here before
+		// they are copied into the arena
+		static thread_local std::vector<asm_token> tokens;
+		static thread_local std::vector<uint32_t> bounds;
 
-		// Now parse the params, if any
 		enum token_type type = token_type::UNKNOWN;
 		char last_char = 0;
-		std::string token;
-		asm_param param;
+		size_t start = 0;
 		int depth = 0;
 
-		for (auto it = params.begin(), end = params.end(); it != end; ++it) {
+		tokens.clear();
+		bounds.clear();
+
+		for (size_t i = 0, e = params.size(); i != e; ++i) {
+			char c = params[i];
 
-			if ((type == token_type::IDENTIFIER && is_identifier_char(*it)) ||
-			    (type == token_type::REGISTER   && is_register_char(*it))   ||
-			    (type == token_type::TYPEFLAG   && is_typeflag_char(*it))   ||
-			    (type == token_type::NUMBER     && is_number_char(*it))) {
-				token += *it;
+			if ((type == token_type::IDENTIFIER && is_identifier_char(c)) ||
+			    (type == token_type::REGISTER   && is_register_char(c))   ||
+			    (type == token_type::TYPEFLAG   && is_typeflag_char(c))   ||
+			    (type == token_type::NUMBER     && is_number_char(c))) {
 				continue;
 			} else if (type == token_type::STRING) {
-				if (*it == '"' && last_char != '\\') {
-					param.add_token(asm_token(token, type));
-					token     = "";
+				if (c == '"' && last_char != '\\') {
+					tokens.push_back(asm_token(string_table::intern(params.substr(start, i - start)), type));
 					type      = token_type::UNKNOWN;
 					last_char = 0;
 				} else {
 					// guard against '\\"'
-					last_char  = last_char != '\\' ? *it : 0;
-					token     += *it;
+					last_char  = last_char != '\\' ? c : 0;
 				}
 				continue;
 			} else if (type == token_type::IDENTIFIER ||
 				   type == token_type::REGISTER   ||
 				   type == token_type::TYPEFLAG   ||
 				   type == token_type::NUMBER) {
-				param.add_token(asm_token(token, type));
-				token     = "";
+				tokens.push_back(asm_token(string_table::intern(params.substr(start, i - start)), type));
 				type      = token_type::UNKNOWN;
 				last_char = 0;
 			}
 
 			// token_type is UNKNOWN
-			switch (*it) {
+			switch (c) {
 			case ' ':
 			case '\t':
 				continue;
 			case ',':
 				if (depth > 0) {
-					param.add_token(asm_token(",", token_type::OPERATOR));
+					tokens.push_back(asm_token(string_table::intern(","), token_type::OPERATOR));
 					continue;
 				}
 
-				statement->add_param(param);
-				param.reset();
+				bounds.push_back(tokens.size());
 
 				break;
 			case '(':
 			case ')':
 			case '[':
 			case ']':
-				depth += (*it == '(') ? 1 : -1;
+				depth += (c == '(') ? 1 : -1;
 				// Fall-Through
 			case '+':
 			case '-':
@@ -1274,94 +1997,58 @@ namespace assembly {
 			case '/':
 			case ':':
 			case '=':
-				token += *it;
-				param.add_token(asm_token(token, token_type::OPERATOR));
-				token = "";
+				tokens.push_back(asm_token(string_table::intern(params.substr(i, 1)), token_type::OPERATOR));
 				break;
 			case '.':
 			case '_':
 			case 'A' ... 'Z':
 			case 'a' ... 'z':
 				// Identifier
-				type   = token_type::IDENTIFIER;
-				token += *it;
+				type  = token_type::IDENTIFIER;
+				start = i;
 				break;
 			case '%':
 				// Register
-				type   = token_type::REGISTER;
-				token += *it;
+				type  = token_type::REGISTER;
+				start = i;
 				break;
 			case '$':
 			case '0' ... '9':
 				// Number
-				type   = token_type::NUMBER;
-				token += *it;
+				type  = token_type::NUMBER;
+				start = i;
 				break;
 			case '"':
-				type   = token_type::STRING;
+				type  = token_type::STRING;
+				start = i + 1;
 				break;
 			case '@':
-				type   = token_type::TYPEFLAG;
-				token += *it;
+				type  = token_type::TYPEFLAG;
+				start = i;
 				break;
 			}
 		}
 
 		if (type != token_type::UNKNOWN)
-			param.add_token(asm_token(token, type));
+			tokens.push_back(asm_token(string_table::intern(params.substr(start)), type));
 
-		if (param.tokens() > 0)
-			statement->add_param(param);
+		if (tokens.size() > (bounds.empty() ? 0 : bounds.back()))
+			bounds.push_back(tokens.size());
 
-		statement->analyze();
+		if (!bounds.empty()) {
+			asm_token *t = alloc.copy(tokens.data(), tokens.size());
+			asm_param *p = static_cast<asm_param*>(alloc.allocate(sizeof(asm_param) * bounds.size(),
+									     alignof(asm_param)));
+			uint32_t begin = 0;
 
-		return statement;
-	}
-
-	std::unique_ptr<asm_statement> copy_statement(const std::unique_ptr<asm_statement> &stmt)
-	{
-		const asm_statement *raw = stmt.get();
-		std::unique_ptr<asm_statement> copy;
-		enum stmt_type type = stmt->type();
-
-		switch (type) {
-		case stmt_type::TYPE:
-			{
-				const asm_type *t = dynamic_cast<const asm_type*>(raw);
-				copy = std::unique_ptr<asm_statement>(new asm_type(*t));
-				break;
-			}
-		case stmt_type::LABEL:
-			{
-				const asm_label *l = dynamic_cast<const asm_label*>(raw);
-				copy = std::unique_ptr<asm_statement>(new asm_label(*l));
-				break;
-			}
-		case stmt_type::SIZE:
-			{
-				const asm_size *s = dynamic_cast<const asm_size*>(raw);
-				copy = std::unique_ptr<asm_statement>(new asm_size(*s));
-				break;
-			}
-		case stmt_type::SECTION:
-			{
-				const asm_section *s = dynamic_cast<const asm_section*>(raw);
-				copy = std::unique_ptr<asm_statement>(new asm_section(*s));
-				break;
-			}
-		case stmt_type::COMM:
-			{
-				const asm_comm *c = dynamic_cast<const asm_comm*>(raw);
-				copy = std::unique_ptr<asm_statement>(new asm_comm(*c));
-				break;
-			}
-		default:
-			{
-				copy = std::unique_ptr<asm_statement>(new asm_statement(*raw));
-				break;
+			for (size_t idx = 0; idx < bounds.size(); ++idx) {
+				new (p + idx) asm_param(t + begin, bounds[idx] - begin);
+				begin = bounds[idx];
 			}
+
+			statement.set_params(p, bounds.size());
 		}
 
-		return copy;
+		statement.analyze();
 	}
 }
@@ -13,13 +13,20 @@
 #ifndef __ASSEMBLY_H
 #define __ASSEMBLY_H
 
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <functional>
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
 #include <map>
-#include <functional>
 
 #include "generic-diff.h"
+#include "string-table.h"
+#include "mapped-file.h"
+#include "arena.h"
 
 namespace assembly {
 
@@ -104,8 +111,20 @@ namespace assembly {
 		STRIP_DEBUG	= 2,
 	};
 
+	// Used as a bitfield. With SKIP_DEBUG, statement indices count only
+	// the loaded statements and differ from a full load, so nothing
+	// keyed by index may be shared between the two modes.
+	enum class load_flags {
+		NONE		= 0,
+		LAZY		= 1,	// Tokenize operands on demand
+		SKIP_DEBUG	= 2,	// Don't load .debug_* section contents
+	};
+
 	using symbol_map = std::map<std::string, std::string>;
 
+	// Maps label names to their replacements
+	using label_map = std::unordered_map<string_id, string_id>;
+
 	constexpr enum func_flags operator|(const enum func_flags f1,
 					    const enum func_flags f2)
 	{
@@ -120,211 +139,317 @@ namespace assembly {
 				static_cast<int>(f1) & static_cast<int>(f2));
 	}
 
+	constexpr enum load_flags operator|(const enum load_flags f1,
+					    const enum load_flags f2)
+	{
+		return static_cast<enum load_flags>(
+				static_cast<int>(f1) | static_cast<int>(f2));
+	}
+
+	constexpr enum load_flags operator&(const enum load_flags f1,
+					    const enum load_flags f2)
+	{
+		return static_cast<enum load_flags>(
+				static_cast<int>(f1) & static_cast<int>(f2));
+	}
+
 	class asm_token {
 	protected:
-		std::string	m_token;
+		string_id	m_token;
 		enum token_type	m_type;
 
 	public:
 
-		asm_token(std::string, enum token_type);
+		asm_token(string_id, enum token_type);
 		enum token_type type() const;
 
-		std::string token() const;
-		void set(std::string);
+		const std::string& token() const;
+		string_id id() const;
+		void set(string_id);
 
 		std::string serialize() const;
 	};
 
+	// Parameters and their tokens live in the arena of the asm_file or
+	// asm_object that owns the statement
 	class asm_param {
 	protected:
-		using token_t			= std::vector<asm_token>;
 		using token_handler		= std::function<void(asm_token&)>;
 		using const_token_handler	= std::function<void(const asm_token&)>;
-		token_t m_tokens;
+
+		asm_token	*m_tokens;
+		uint32_t	m_count;
 
 	public:
-		template<typename T>
-		void add_token(T&&);
-		void reset();
+		asm_param(asm_token*, uint32_t);
+
+		asm_param clone(arena&) const;
+
 		size_t tokens() const;
-		void token(token_t::size_type,
-			   std::function<void(enum token_type, std::string)>) const;
+		asm_token& token(size_t);
+		const asm_token& token(size_t) const;
+		void token(size_t,
+			   std::function<void(enum token_type, const std::string&)>) const;
 		void for_each_token(token_handler);
 		void for_each_token(const_token_handler) const;
 		std::string serialize() const;
 	};
 
+	class parse_cache;
+
+	// All statements share one flat record. The data that is specific
+	// to a statement type lives in a union which is selected by m_type.
 	class asm_statement {
 	protected:
-		using param_type		= std::vector<asm_param>;
 		using param_handler		= std::function<void(asm_param&)>;
 		using const_param_handler	= std::function<void(const asm_param&)>;
 
-		std::string		m_stmt;
-		std::string		m_instr;
+		std::string_view	m_stmt;
+		string_id		m_instr;
 		enum stmt_type		m_type;
-		param_type		m_params;
+		uint32_t		m_nparams;
+		bool			m_deferred;	// Operands not tokenized yet
+		asm_param		*m_params;
+
+		union {
+			// stmt_type::TYPE
+			struct {
+				string_id		symbol;
+				enum symbol_type	type;
+			} m_symtype;
+
+			// stmt_type::SIZE
+			struct {
+				string_id		symbol;
+			} m_size;
+
+			// stmt_type::SECTION
+			struct {
+				string_id		name;
+				string_id		flags;
+				bool			executable;
+			} m_section;
+
+			// stmt_type::COMM
+			struct {
+				string_id		symbol;
+				uint32_t		alignment;
+				uint64_t		size;
+			} m_comm;
+		};
+
+		string_id param_identifier(size_t) const;
+		string_id symbol_field() const;
+
+		void analyze_type();
+		void analyze_size();
+		void analyze_section();
+		void analyze_comm();
+
+		friend class parse_cache;
 
 	public:
-		asm_statement(std::string);
-		virtual void rename_label(std::string, std::string);
-		virtual void analyze();
+		asm_statement(std::string_view, enum stmt_type);
+
+		bool references(const label_map&) const;
+		void rename_labels(const label_map&);
+		void analyze();
 
 		bool operator==(const asm_statement&) const;
 		bool operator!=(const asm_statement&) const;
 
-		void type(enum stmt_type);
+		// Equal statements have equal hashes
+		uint64_t hash() const;
+
 		enum stmt_type type() const;
 
-		std::string raw()   const;
-		std::string instr() const;
+		std::string_view raw() const;
+		const std::string& instr() const;
+		string_id instr_id() const;
 
-		void set_instr(std::string);
+		void set_instr(string_id);
 
-		template<typename T> void add_param(T&&);
+		void set_params(asm_param*, uint32_t);
+		void clone_params(arena&);
 
-		void param(param_type::size_type, param_handler);
-		void param(param_type::size_type, const_param_handler) const;
+		bool deferred() const;
+		void set_deferred(bool);
+		void tokenize(arena&);
+
+		void param(size_t, param_handler);
+		void param(size_t, const_param_handler) const;
 		void for_each_param(param_handler);
 		void for_each_param(const_param_handler) const;
 
 		void map_symbols(symbol_map&, const asm_statement&) const;
 
 		std::string serialize() const;
-		std::string statement() const;
-	};
+		std::string_view statement() const;
 
-	class asm_type : public asm_statement {
-	protected:
-		enum symbol_type	m_stype;
-		std::string		m_symbol;
+		// LABEL statements
+		const std::string& get_label() const;
+		string_id label_id() const;
 
-	public:
-		asm_type(std::string);
-		virtual void rename_label(std::string, std::string);
-		enum symbol_type get_type() const;
-		std::string get_symbol() const;
-		virtual void analyze();
-	};
+		// TYPE, SIZE and COMM statements
+		const std::string& get_symbol() const;
+		string_id symbol_id() const;
 
-	class asm_label : public asm_statement {
-	public:
-		asm_label(std::string);
+		// TYPE statements
+		enum symbol_type get_symbol_type() const;
 
-		virtual void rename_label(std::string, std::string);
-
-		std::string get_label() const;
+		// SECTION statements
+		const std::string& get_name() const;
+		bool executable() const;
 	};
 
-	class asm_size : public asm_statement {
-	protected:
-		std::string m_symbol;
-
-	public:
-		asm_size(std::string);
-		virtual void rename_label(std::string, std::string);
-
-		virtual void analyze();
+	struct asm_symbol {
+		size_t			m_idx;
+		size_t			m_size_idx;
+		size_t			m_section_idx;
+		size_t			m_align_idx;
+		size_t			m_type_idx;
+		size_t			m_end_idx;	// Statements of the symbol end here
+		enum symbol_type	m_type;
+		enum symbol_scope	m_scope;
 
-		std::string get_symbol() const;
+		asm_symbol();
 	};
 
-	class asm_section : public asm_statement {
-	protected:
-		std::string m_name;
-		std::string m_flags;
-		bool m_executable;
-
+	// Symbols of a file, indexed by their interned name with an
+	// open-addressing hash table. Entries are stored in insertion
+	// order until sort() puts them into name order.
+	class symbol_table {
 	public:
-		asm_section(std::string);
-		virtual void rename_label(std::string, std::string);
+		using entry = std::pair<string_id, asm_symbol>;
 
-		virtual void analyze();
-
-		std::string get_name() const;
-		bool executable() const;
-	};
-
-	class asm_comm : public asm_statement {
 	protected:
-		std::string	m_symbol;
-		uint32_t	m_alignment;
-		uint64_t	m_size;
+		std::vector<entry>	m_entries;
+		std::vector<uint32_t>	m_slots;	// Entry index + 1, 0 is free
+
+		size_t slot(string_id) const;
+		void rehash(size_t);
 
 	public:
-		asm_comm(std::string);
-		virtual void rename_label(std::string, std::string);
+		symbol_table();
 
-		virtual void analyze();
+		// Adds a default symbol if the name is not present yet.
+		// References are invalidated by the next insertion.
+		asm_symbol& operator[](string_id);
 
-		std::string get_symbol() const;
-	};
+		// Returns nullptr if there is no such symbol
+		const asm_symbol* find(string_id) const;
 
-	struct asm_symbol {
-		size_t			m_idx;
-		size_t			m_size_idx;
-		size_t			m_section_idx;
-		size_t			m_align_idx;
-		size_t			m_type_idx;
-		enum symbol_type	m_type;
-		enum symbol_scope	m_scope;
+		void erase(const std::unordered_set<string_id>&);
+		void sort();
 
-		asm_symbol();
+		size_t size() const;
+
+		std::vector<entry>::iterator begin();
+		std::vector<entry>::iterator end();
+		std::vector<entry>::const_iterator begin() const;
+		std::vector<entry>::const_iterator end() const;
 	};
 
+	// An object is a view of statements owned by an asm_file, which
+	// has to outlive it. Statements are only copied into the object
+	// when they are modified.
 	class asm_object : public diff::diffable<asm_statement> {
 	protected:
-		std::vector<std::unique_ptr<asm_statement>>	m_statements;
-		std::string					m_name;
+		arena					m_arena;
+		std::vector<const asm_statement*>	m_statements;
+		std::vector<bool>			m_private;
+		std::string				m_name;
+
+		// Statement hashes and the rolling hash over all of them,
+		// computed on first use after the object is complete
+		mutable std::vector<uint64_t>		m_hashes;
+		mutable uint64_t			m_content_hash;
+
+		void update_hashes() const;
 
 	public:
 		asm_object(std::string);
 
-		void add_statement(const std::unique_ptr<asm_statement> &stmt);
+		void add_statement(const asm_statement &stmt);
+		asm_statement& modify(size_t);
 
-		void for_each_statement(std::function<void(asm_statement&)>);
+		void for_each_statement(std::function<void(const asm_statement&)>) const;
 
 		// Diffable interface
 		virtual diff::size_type elements() const;
 		virtual const asm_statement& element(diff::size_type) const;
+		virtual uint64_t hash(diff::size_type) const;
+		virtual uint64_t content_hash() const;
 
 		std::vector<std::string> get_symbols() const;
 		void get_symbol_map(symbol_map&, const asm_object&) const;
 	};
 
 	class asm_file {
-		std::vector<std::unique_ptr<asm_statement>>	m_statements;
-		std::map<std::string, asm_symbol>		m_symbols;
+		mutable std::vector<asm_statement>		m_statements;
+		symbol_table					m_symbols;
 		std::string					m_filename;
 
+		// Statements point into the mapped input file, or into
+		// the arena for input lines that had to be rewritten. The
+		// arena owns all parameters and tokens.
+		mapped_file					m_input;
+		arena						m_arena;
+
+		// Text of rewritten lines when loaded from the parse cache
+		mapped_file					m_cache;
+
+		// Printed at the end of load(), kept for the parse cache
+		std::string					m_warnings;
+
+		// With load_flags::LAZY most statements are only tokenized
+		// when an object containing them is requested
+		bool						m_lazy;
+		mutable arena					m_lazy_arena;
+		std::unique_ptr<std::mutex>			m_lazy_lock;
+
+		void analyze_statements();
 		void cleanup_symbol_table();
+		size_t function_end(size_t, string_id) const;
+		size_t object_end(size_t) const;
+		void tokenize(size_t, size_t) const;
+
+		friend class parse_cache;
 
 	public:
 		template<typename T> inline asm_file(T&& fn)
-			: m_filename(std::forward<T>(fn))
+			: m_filename(std::forward<T>(fn)), m_lazy(false),
+			  m_lazy_lock(new std::mutex)
 		{}
 
-		void load();
+		// Parses with up to threads threads, 0 means one per CPU
+		void load(enum load_flags = load_flags::NONE, unsigned threads = 0);
 
 		const asm_statement& stmt(unsigned) const;
 
-		void for_each_symbol(std::function<void(std::string, asm_symbol)>);
+		// Visits the symbols in name order
+		void for_each_symbol(std::function<void(const std::string&, const asm_symbol&)>) const;
+
+		// Returns nullptr if there is no such symbol. The handle
+		// stays valid as long as the file.
+		const asm_symbol* find_symbol(std::string_view) const;
 
-		bool has_symbol(std::string) const;
-		const asm_symbol& get_symbol(std::string) const;
+		bool has_symbol(const std::string&) const;
+		const asm_symbol& get_symbol(const std::string&) const;
 
-		bool has_function(std::string) const;
-		std::unique_ptr<asm_object> get_function(std::string, enum func_flags) const;
+		bool has_function(const std::string&) const;
+		std::unique_ptr<asm_object> get_function(const std::string&, enum func_flags) const;
 
-		bool has_object(std::string) const;
-		std::unique_ptr<asm_object> get_object(std::string, enum func_flags) const;
+		bool has_object(const std::string&) const;
+		std::unique_ptr<asm_object> get_object(const std::string&, enum func_flags) const;
 	};
 
 	using asm_diff = diff::diff<assembly::asm_statement>;
 
-	std::unique_ptr<asm_statement> parse_statement(std::string);
-	std::unique_ptr<asm_statement> copy_statement(const std::unique_ptr<asm_statement>&);
+	// Returns a statement of type NOSTMT for empty input. Deferred
+	// statements only get their operands tokenized when they matter
+	// for the symbol table.
+	asm_statement parse_statement(std::string_view, arena&, bool deferred = false);
 
 } // namespace assembly
 
@@ -37,7 +37,7 @@ static void cg_from_one_function(assembly::asm_file &file,
 		return;
 
 	fn->for_each_statement([&result, &rs_name, &symbols, &opts]
-			       (assembly::asm_statement &stmt) {
+			       (const assembly::asm_statement &stmt) {
 		if (stmt.type() != assembly::stmt_type::INSTRUCTION)
 			return;
 
@@ -49,7 +49,7 @@ static void cg_from_one_function(assembly::asm_file &file,
 		stmt.param(0, [&result, &rs_name, &symbols, &opts]
 			      (const assembly::asm_param &param) {
 			if (!param.tokens()) {
-				std::cerr << "Error: Empty param in call instruction" << std::endl;
+				diag() << "Error: Empty param in call instruction" << std::endl;
 				return;
 			}
 			param.token(0, [&result, &rs_name, &symbols, &opts]
@@ -86,7 +86,7 @@ static void generate_callgraph_from_functions(std::vector<assembly::asm_file> &f
 		for (size_t idx = 0, size = files.size(); idx != size; ++idx) {
 			files[idx].for_each_symbol([&files, &results, &new_results, &symbols,
 						    &opts, &idx, &new_functions, &tmp_functions]
-						   (std::string sym, assembly::asm_symbol info) {
+						   (const std::string &sym, const assembly::asm_symbol &info) {
 
 				if (info.m_type != assembly::symbol_type::FUNCTION)
 					return;
@@ -119,9 +119,80 @@ static void generate_callgraph_from_functions(std::vector<assembly::asm_file> &f
 	}
 }
 
+static void print_callgraph_dot(std::ostream &os, size_t nfiles,
+				const result_type &results,
+				std::map<std::string, size_t> &sym_file_map,
+				const struct cg_options &opts)
+{
+	os << "digraph {" << '\n';
+	// rankdir=Lr seems to produce better results
+	os << "\trankdir=LR;" << '\n';
+
+	// Print the results
+	std::string indent = "";
+	bool subgraphs = false;
+
+	if (nfiles > 1) {
+		indent = "\t";
+		subgraphs = true;
+	}
+
+	for (size_t idx = 0; idx != nfiles; ++idx) {
+		if (subgraphs) {
+			os << "\tsubgraph cluster_" << idx << " {" << '\n';
+			os << "\t\tlabel=\"" << base_name(opts.input_files[idx]) << "\";" << '\n';
+		}
+
+		for (auto &r : results) {
+			int num = 0;
+
+			if (sym_file_map[r.first] != idx)
+				continue;
+
+			os << indent << '\t' << r.first << " -> {";
+			for (auto &s : r.second) {
+				if (num++)
+					os << ", ";
+				os << s;
+			}
+
+			os << '}' << '\n';
+
+		}
+
+		if (subgraphs) {
+			os << "\t}" << '\n';
+		}
+	}
+
+	os << "}" << '\n';
+}
+
+static void print_callgraph_records(std::ostream &os, const result_type &results,
+				    std::map<std::string, size_t> &sym_file_map,
+				    const struct cg_options &opts)
+{
+	record_writer records(os, opts.format);
+
+	// One record per call edge
+	for (auto &r : results) {
+		const char *file = opts.input_files[sym_file_map[r.first]];
+
+		for (auto &s : r.second) {
+			json_writer &json = records.begin();
+
+			json.begin_object();
+			json.key("file").value(file);
+			json.key("from").value(r.first);
+			json.key("to").value(s);
+			json.end_object();
+			records.end();
+		}
+	}
+}
+
 void generate_callgraph(const struct cg_options &opts)
 {
-	const char *output_file = opts.output_file.c_str();
 	std::map<std::string, size_t> sym_file_map;
 	std::vector<assembly::asm_file> files;
 	std::vector<std::string> functions;
@@ -133,14 +204,13 @@ void generate_callgraph(const struct cg_options &opts)
 		files.emplace_back(fn);
 
 	for (auto &file : files)
-		file.load();
-
-	of.open(output_file);
+		file.load(opts.skip_debug ? assembly::load_flags::SKIP_DEBUG :
+					    assembly::load_flags::NONE);
 
 	for (size_t idx = 0, size = files.size(); idx != size; ++idx) {
 		// First fill the results with known symbols
 		files[idx].for_each_symbol([&results, &opts, &idx, &sym_file_map, &symbols, &functions]
-				     (std::string sym, assembly::asm_symbol info) {
+				     (const std::string &sym, const assembly::asm_symbol &info) {
 			// First check if this symbol is a function
 			if (info.m_type != assembly::symbol_type::FUNCTION)
 				return;
@@ -161,52 +231,24 @@ void generate_callgraph(const struct cg_options &opts)
 	} else {
 		for (size_t idx = 0, size = files.size(); idx != size; ++idx) {
 			files[idx].for_each_symbol([&files, &results, &symbols, &opts, &idx]
-						   (std::string sym, assembly::asm_symbol info) {
+						   (const std::string &sym, const assembly::asm_symbol &info) {
 				cg_from_one_function(files[idx], sym, results, symbols, opts);
 			});
 		}
 	}
 
-	of << "digraph {" << std::endl;
-	// rankdir=Lr seems to produce better results
-	of << "\trankdir=LR;" << std::endl;
+	// An output file of "-" is standard output
+	std::ostream *os = &std::cout;
 
-	// Print the results
-	std::string indent = "";
-	bool subgraphs = false;
-
-	if (files.size() > 1) {
-		indent = "\t";
-		subgraphs = true;
+	if (opts.output_file != "-") {
+		of.open(opts.output_file);
+		os = &of;
 	}
 
-	for (size_t idx = 0, size = files.size(); idx != size; ++idx) {
-		if (subgraphs) {
-			of << "\tsubgraph cluster_" << idx << " {" << std::endl;
-			of << "\t\tlabel=\"" << base_name(opts.input_files[idx]) << "\";" << std::endl;
-		}
-
-		for (auto &r : results) {
-			int num = 0;
-
-			if (sym_file_map[r.first] != idx)
-				continue;
-
-			of << indent << '\t' << r.first << " -> {";
-			for (auto &s : r.second) {
-				if (num++)
-					of << ", ";
-				of << s;
-			}
-
-			of << '}' << std::endl;
-
-		}
-
-		if (subgraphs) {
-			of << "\t}" << std::endl;
-		}
+	if (opts.format != output_format::TEXT) {
+		print_callgraph_records(*os, results, sym_file_map, opts);
+		return;
 	}
 
-	of << "}" << std::endl;
+	print_callgraph_dot(*os, files.size(), results, sym_file_map, opts);
 }
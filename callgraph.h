@@ -16,16 +16,20 @@
 #include <vector>
 #include <string>
 
+#include "output.h"
+
 struct cg_options {
 	std::vector<const char*> input_files;
 	std::vector<std::string> functions;
 	std::string output_file;
 	bool include_external;
+	bool skip_debug;
 	unsigned maxdepth;
+	enum output_format format;	// TEXT is the dot format
 
 	inline cg_options()
 		: output_file("callgraph.dot"), include_external(false),
-		  maxdepth(~0)
+		  skip_debug(true), maxdepth(~0), format(output_format::TEXT)
 	{}
 };
 
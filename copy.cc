@@ -17,49 +17,51 @@
 #include <set>
 
 #include "assembly.h"
+#include "output.h"
 #include "copy.h"
 
 static void copy_symbol(const std::string &symbol,
 			const assembly::asm_file &file,
 			std::ostream &os)
 {
-	if (!file.has_symbol(symbol)) {
-		std::cerr << "Error: Symbol not found: " << symbol << std::endl;
+	const assembly::asm_symbol *sym = file.find_symbol(symbol);
+
+	if (sym == nullptr) {
+		diag() << "Error: Symbol not found: " << symbol << std::endl;
 		return;
 	}
 
 	auto func = std::unique_ptr<assembly::asm_object>(nullptr);
-	auto sym  = file.get_symbol(symbol);
 
-	if (file.has_function(symbol)) {
+	if (sym->m_type == assembly::symbol_type::FUNCTION) {
 		func = file.get_function(symbol, assembly::func_flags::STRIP_DEBUG);
-	} else if (file.has_object(symbol)) {
+	} else if (sym->m_type == assembly::symbol_type::OBJECT) {
 		func = file.get_object(symbol, assembly::func_flags::STRIP_DEBUG);
 	} else {
-		std::cerr << "Symbol not found: " << symbol << std::endl;
+		diag() << "Symbol not found: " << symbol << std::endl;
 		return;
 	}
 
-	if (sym.m_section_idx)
-		os << '\t' << file.stmt(sym.m_section_idx).raw() << std::endl;
+	if (sym->m_section_idx)
+		os << '\t' << file.stmt(sym->m_section_idx).raw() << '\n';
 
-	if (sym.m_align_idx)
-		os << '\t' << file.stmt(sym.m_align_idx).raw() << std::endl;
+	if (sym->m_align_idx)
+		os << '\t' << file.stmt(sym->m_align_idx).raw() << '\n';
 
-	if (sym.m_type_idx)
-		os << '\t' << file.stmt(sym.m_type_idx).raw() << std::endl;
+	if (sym->m_type_idx)
+		os << '\t' << file.stmt(sym->m_type_idx).raw() << '\n';
 
-	if (sym.m_type == assembly::symbol_type::OBJECT && sym.m_size_idx)
-		os << '\t' << file.stmt(sym.m_size_idx).raw() << std::endl;
+	if (sym->m_type == assembly::symbol_type::OBJECT && sym->m_size_idx)
+		os << '\t' << file.stmt(sym->m_size_idx).raw() << '\n';
 
-	os << symbol << ':' << std::endl;
-	func->for_each_statement([&os](assembly::asm_statement &stmt) {
+	os << symbol << ':' << '\n';
+	func->for_each_statement([&os](const assembly::asm_statement &stmt) {
 		std::string prefix(stmt.type() == assembly::stmt_type::LABEL ? "" : "\t");
-		os << prefix << stmt.raw() << std::endl;
+		os << prefix << stmt.raw() << '\n';
 	});
 
-	if (sym.m_type == assembly::symbol_type::FUNCTION && sym.m_size_idx)
-		os << '\t' << file.stmt(sym.m_size_idx).raw() << std::endl;
+	if (sym->m_type == assembly::symbol_type::FUNCTION && sym->m_size_idx)
+		os << '\t' << file.stmt(sym->m_size_idx).raw() << '\n';
 }
 
 void copy_functions(const std::string &filename,
@@ -70,12 +72,12 @@ void copy_functions(const std::string &filename,
 	assembly::asm_file file(filename);
 
 
-	file.load();
+	file.load(assembly::load_flags::LAZY);
 
 	for (auto fn : symbols) {
 
 		if (!file.has_function(fn)) {
-			std::cerr << "Function not found: " << fn << std::endl;
+			diag() << "Function not found: " << fn << std::endl;
 			continue;
 		}
 
@@ -83,22 +85,19 @@ void copy_functions(const std::string &filename,
 		std::vector<std::string> syms = func->get_symbols();
 
 		for (auto s : syms) {
-			if (!file.has_symbol(s))
-				continue;
-
-			auto sym = file.get_symbol(s);
+			const assembly::asm_symbol *sym = file.find_symbol(s);
 
-			if (sym.m_scope != assembly::symbol_scope::LOCAL)
+			if (sym == nullptr || sym->m_scope != assembly::symbol_scope::LOCAL)
 				continue;
 
-			if (sym.m_type == assembly::symbol_type::FUNCTION)
+			if (sym->m_type == assembly::symbol_type::FUNCTION)
 				functions.emplace(s);
-			else if (sym.m_type == assembly::symbol_type::OBJECT)
+			else if (sym->m_type == assembly::symbol_type::OBJECT)
 				objects.emplace(s);
 		}
 
 		copy_symbol(fn, file, os);
-		os << "\t.globl " << fn << std::endl;
+		os << "\t.globl " << fn << '\n';
 	}
 
 
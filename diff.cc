@@ -10,66 +10,67 @@
  * Author: Joerg Roedel <jroedel@suse.de>
  */
 
+#include <condition_variable>
 #include <functional>
+#include <filesystem>
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <numeric>
 #include <sstream>
 #include <string>
 #include <vector>
-#include <limits>
-#include <list>
+#include <thread>
+#include <mutex>
+#include <tuple>
+#include <set>
 
 #include <unistd.h>
 
 #include "assembly.h"
 #include "generic-diff.h"
 #include "helper.h"
+#include "output.h"
 #include "diff.h"
 
-// For caching diff results of individual symbols
-struct diff_result {
-	std::string symbol1;
-	std::string symbol2;
-	bool flat_diff;
-
-	diff_result()
-		: flat_diff(false)
-	{
-	}
-};
-
-// Diff dependency chain
-struct diff_chain;
-
-using sym_list = std::list<struct diff_chain>;
-
-struct diff_chain {
-	assembly::symbol_type type;
-	std::string symbol1;
-	std::string symbol2;
-	bool flat_diff;
-	bool deep_diff;
-	sym_list list;
-
-	diff_chain(assembly::symbol_type t, std::string s1, std::string s2)
-		: type(t), symbol1(s1), symbol2(s2), flat_diff(true), deep_diff(true)
+// Result of comparing two symbols without following the symbols they
+// reference
+struct flat_result {
+	bool valid;			// Both symbols could be extracted
+	bool flat_diff;			// No differences found
+	assembly::symbol_map map;	// Referenced symbols, if no differences
+	std::string listing;		// Output of --show, if differences.
+					// A JSON array of hunks for the
+					// JSON formats.
+
+	flat_result()
+		: valid(false), flat_diff(false)
 	{
 	}
 };
 
-using result_map = std::map<std::string, struct diff_result>;
+using flat_key = std::tuple<std::string, std::string, assembly::symbol_type>;
 
 constexpr auto oflags = assembly::func_flags::STRIP_DEBUG | assembly::func_flags::NORMALIZE;
 
 diff_options::diff_options()
-	: show(false), pretty(false), color(true), context(3)
+	: show(false), pretty(false), color(true), skip_debug(true), context(3),
+	  algorithm(diff::algorithm::MYERS),
+	  jobs(std::max(std::thread::hardware_concurrency(), 1U)),
+	  format(output_format::TEXT)
 { }
 
-static void print_diff_line(assembly::asm_object &fn1,
+static enum assembly::load_flags load_flags(const struct diff_options &opts)
+{
+	return opts.skip_debug ? assembly::load_flags::SKIP_DEBUG :
+				 assembly::load_flags::NONE;
+}
+
+static void print_diff_line(std::ostream &os,
+			    assembly::asm_object &fn1,
 			    assembly::asm_object &fn2,
-			    diff::diff_element &item,
-			    struct diff_options &opts)
+			    const diff::diff_element &item,
+			    const struct diff_options &opts)
 {
 	static const char *reset = "\033[0m";
 	static const char *black = "\033[30m";
@@ -77,7 +78,7 @@ static void print_diff_line(assembly::asm_object &fn1,
 	static const char *green = "\033[32m";
 
 	const char *color = "", *no_color = "";
-	std::string str0, str1, str2;
+	std::string_view str1, str2;
 	bool colors = opts.color;
 	char c = ' ';
 
@@ -87,146 +88,131 @@ static void print_diff_line(assembly::asm_object &fn1,
 	case diff::diff_type::EQUAL:
 		c     = ' ';
 		color = colors ? black : "";
-		str0  = fn1.element(item.idx_a).statement();
 		str1  = fn1.element(item.idx_a).statement();
 		str2  = fn2.element(item.idx_b).statement();
 		break;
 	case diff::diff_type::ADDED:
 		c     = '+';
 		color = colors ? green : "";
-		str0  = fn2.element(item.idx_b).statement();
-		str1  = "";
 		str2  = fn2.element(item.idx_b).statement();
 		break;
 	case diff::diff_type::REMOVED:
 		c     = '-';
 		color = colors ? red : "";
-		str0  = fn1.element(item.idx_a).statement();
 		str1  = fn1.element(item.idx_a).statement();
-		str2  = "";
 		break;
 	}
 
-	str0 = expand_tab(trim(str0));
-	str1 = expand_tab(trim(str1));
-	str2 = expand_tab(trim(str2));
+	os << color;
 
-	if (str1.size() >= 40)
-		str1 = str1.substr(0, 34) + "[...]";
+	if (opts.pretty) {
+		std::string col1 = expand_tab(trim(str1));
+		std::string col2 = expand_tab(trim(str2));
 
-	if (str2.size() >= 40)
-		str2 = str2.substr(0, 34) + "[...]";
+		if (col1.size() >= 40)
+			col1 = col1.substr(0, 34) + "[...]";
 
-	std::cout << color;
+		if (col2.size() >= 40)
+			col2 = col2.substr(0, 34) + "[...]";
 
-	if (opts.pretty)
-		std::cout << "         " << std::setw(40) << str1 << "| " << str2;
-	else
-		std::cout << "        " << c << str0;
+		os << "         " << std::setw(40) << col1 << "| " << col2;
+	} else {
+		os << "        " << c;
+		expand_tab(os, trim(item.type == diff::diff_type::ADDED ? str2 : str1));
+	}
 
-	std::cout << no_color << std::endl;
+	os << no_color << '\n';
 }
 
-static void print_diff(assembly::asm_object &fn1, assembly::asm_object &fn2,
-		       assembly::asm_diff &diff, struct diff_options &opts)
+static void print_diff(std::ostream &os,
+		       assembly::asm_object &fn1, assembly::asm_object &fn2,
+		       assembly::asm_diff &diff, const struct diff_options &opts)
 {
-	auto diff_info = diff.get_diff();
-	auto size = diff_info.size();
-	decltype(size) context = opts.context;
-	decltype(size) i, to_print = 0;
-
-	// Initialize to_print
-	for (i = 0; i < context + 1; ++i) {
-		if (i == size)
-			break;
-
-		if (diff_info[i].type != diff::diff_type::EQUAL)
-			to_print = i + context + 1;
-	}
-
-	for (i = 0; i < size; ++i) {
-		if (to_print) {
-			print_diff_line(fn1, fn2, diff_info[i], opts);
-			to_print -= 1;
-		}
+	auto edits = diff.get_edits();
+	diff::hunks hunks(edits, opts.context);
+	struct diff::hunk hunk;
 
-		auto next = std::min(i + context + 1, size - 1);
+	while (hunks.next(hunk)) {
+		if (hunk.separated)
+			os << "         [...]" << '\n';
 
-		if (diff_info[next].type != diff::diff_type::EQUAL) {
-			if (!to_print)
-				std::cout << "         [...]" << std::endl;
+		for (auto it = hunk.begin; it != hunk.end; ++it)
+			print_diff_line(os, fn1, fn2, *it, opts);
+	}
+}
 
-			to_print = (2 * context) + 1;
-		}
+static const char *type_name(enum assembly::symbol_type type)
+{
+	switch (type) {
+	case assembly::symbol_type::FUNCTION:
+		return "function";
+	case assembly::symbol_type::OBJECT:
+		return "object";
+	default:
+		return "unknown";
 	}
 }
 
-static void compare(const assembly::asm_file &file1,
-		    const assembly::asm_file &file2,
-		    std::string fname1,
-		    std::string fname2,
-		    enum assembly::symbol_type type,
-		    result_map &results,
-		    struct diff_chain &chain);
-
-static bool compare_symbol_map(const assembly::asm_file &file1,
-			       const assembly::asm_file &file2,
-			       assembly::symbol_map &map,
-			       result_map &results,
-			       struct diff_chain &chain)
+// Same as print_diff(), as a JSON array of hunks
+static void print_diff_json(json_writer &json,
+			    assembly::asm_object &fn1, assembly::asm_object &fn2,
+			    assembly::asm_diff &diff, const struct diff_options &opts)
 {
-	bool ret = true;
+	auto edits = diff.get_edits();
+	diff::hunks hunks(edits, opts.context);
+	struct diff::hunk hunk;
 
-	for (auto it = map.begin(), end = map.end(); it != end; ++it) {
-		enum assembly::symbol_type type = assembly::symbol_type::UNKNOWN;
+	json.begin_array();
 
-		if (file1.has_function(it->second)) {
-			type = assembly::symbol_type::FUNCTION;
-			if (!file2.has_function(it->first))
-				continue;
-		} else if (file1.has_object(it->second)) {
-			type = assembly::symbol_type::OBJECT;
-			if (!file2.has_object(it->first))
-				continue;
-		} else {
+	while (hunks.next(hunk)) {
+		if (hunk.begin == hunk.end)
 			continue;
-		}
 
-		struct diff_chain nested(type, it->second, it->first);
-
-		compare(file1, file2, it->second, it->first, type, results, nested);
+		json.begin_object().key("lines").begin_array();
+
+		for (auto it = hunk.begin; it != hunk.end; ++it) {
+			json.begin_object();
+
+			switch (it->type) {
+			case diff::diff_type::EQUAL:
+				json.key("type").value("equal");
+				json.key("old").value(it->idx_a);
+				json.key("new").value(it->idx_b);
+				json.key("text").value(trim(fn1.element(it->idx_a).statement()));
+				break;
+			case diff::diff_type::ADDED:
+				json.key("type").value("added");
+				json.key("new").value(it->idx_b);
+				json.key("text").value(trim(fn2.element(it->idx_b).statement()));
+				break;
+			case diff::diff_type::REMOVED:
+				json.key("type").value("removed");
+				json.key("old").value(it->idx_a);
+				json.key("text").value(trim(fn1.element(it->idx_a).statement()));
+				break;
+			}
 
-		chain.list.push_back(nested);
+			json.end_object();
+		}
 
-		ret = ret && nested.deep_diff;
+		json.end_array().end_object();
 	}
 
-	return ret;
+	json.end_array();
 }
 
-static void compare(const assembly::asm_file &file1,
-		    const assembly::asm_file &file2,
-		    std::string fname1,
-		    std::string fname2,
-		    enum assembly::symbol_type type,
-		    result_map &results,
-		    struct diff_chain &chain)
+static void compare_flat(const assembly::asm_file &file1,
+			 const assembly::asm_file &file2,
+			 const flat_key &key,
+			 struct flat_result &result,
+			 const struct diff_options *opts)
 {
-	chain.type = type;
-	// First check if we already compared these functions
-	if (results.find(fname2) != results.end()) {
-		chain.deep_diff = chain.flat_diff = results[fname2].flat_diff;
-		return;
-	}
-
-	results[fname2].symbol1 = fname1;
-	results[fname2].symbol2 = fname2;
-
-	// We didn't, run compare
+	const std::string &fname1 = std::get<0>(key);
+	const std::string &fname2 = std::get<1>(key);
 	std::unique_ptr<assembly::asm_object> obj1(nullptr);
 	std::unique_ptr<assembly::asm_object> obj2(nullptr);
 
-	if (type == assembly::symbol_type::FUNCTION) {
+	if (std::get<2>(key) == assembly::symbol_type::FUNCTION) {
 		obj1 = std::unique_ptr<assembly::asm_object>(file1.get_function(fname1, oflags));
 		obj2 = std::unique_ptr<assembly::asm_object>(file2.get_function(fname2, oflags));
 	} else {
@@ -234,182 +220,738 @@ static void compare(const assembly::asm_file &file1,
 		obj2 = std::unique_ptr<assembly::asm_object>(file2.get_object(fname2, oflags));
 	}
 
-	if (obj1 == nullptr || obj2 == nullptr) {
-		results[fname2].flat_diff = false;
+	if (obj1 == nullptr || obj2 == nullptr)
 		return;
-	}
 
-	assembly::asm_diff compare(*obj1, *obj2);
+	result.valid = true;
+
+	assembly::asm_diff compare(*obj1, *obj2,
+				   opts ? opts->algorithm : diff::algorithm::MYERS);
 
 	if (compare.is_different()) {
-		results[fname2].flat_diff = false;
-		chain.flat_diff = false;
-		chain.deep_diff = false;
-	} else {
-		assembly::symbol_map map;
+		result.flat_diff = false;
+
+		if (opts && opts->show) {
+			std::ostringstream os;
 
-		// Flat diff didn't show any differences
-		results[fname2].flat_diff = true;
-		chain.flat_diff = true;
+			if (opts->format == output_format::TEXT) {
+				os << std::left;
+				print_diff(os, *obj1, *obj2, compare, *opts);
+			} else {
+				json_writer json(os);
 
-		// We need to set deep_diff to true here because it might be
-		// used in compare_symbol_map when we have functions that call
-		// each other recursivly, so make sure it has a defined value
-		// there. We update it to the real value when compare_symbol_map
-		// returns.
-		chain.deep_diff = true;
+				print_diff_json(json, *obj1, *obj2, compare, *opts);
+			}
 
-		obj2->get_symbol_map(map, *obj1);
+			result.listing = os.str();
+		}
+	} else {
+		result.flat_diff = true;
 
-		chain.deep_diff = compare_symbol_map(file1, file2, map, results, chain);
+		obj2->get_symbol_map(result.map, *obj1);
 	}
 }
 
-void print_diff_chain(struct diff_chain &chain, std::string indent = "")
-{
-	std::cout << indent << "-> " << chain.symbol2;
-	if (chain.symbol1 != chain.symbol2)
-		std::cout << " (was " << chain.symbol1 << ")";
-	std::cout << "[" << (chain.type == assembly::symbol_type::FUNCTION ? 'f' : 'o')
-		  << (chain.flat_diff ? "=" : "!") << "]" << std::endl;
-
-	for (auto l = chain.list.begin(), end = chain.list.end(); l != end; ++l) {
-		if (l->deep_diff == false)
-			print_diff_chain(*l, indent + "    ");
+// Flat comparisons don't depend on each other, so they can run in
+// parallel. The dependency chains are then built in order on top of
+// them, which keeps the output independent of the number of threads.
+class flat_cache {
+private:
+	const assembly::asm_file		&m_file1;
+	const assembly::asm_file		&m_file2;
+	std::map<flat_key, struct flat_result>	m_results;
+
+public:
+	flat_cache(const assembly::asm_file &file1, const assembly::asm_file &file2)
+		: m_file1(file1), m_file2(file2)
+	{
 	}
-}
 
-void diff_files(const char *fname1, const char *fname2, struct diff_options &opts)
-{
-	assembly::asm_file file1(fname1);
-	assembly::asm_file file2(fname2);
-	bool changes = false;
+	void prefetch(const std::vector<flat_key> &keys, const struct diff_options &opts)
+	{
+		std::vector<std::pair<const flat_key*, struct flat_result*>> work;
 
-	try {
-		std::vector<std::string> f1_objects, f2_objects;
-		std::map<std::string, struct diff_result> results;
+		for (auto &key : keys) {
+			auto ret = m_results.emplace(key, flat_result());
 
-		file1.load();
-		file2.load();
+			if (ret.second)
+				work.emplace_back(&ret.first->first, &ret.first->second);
+		}
 
-		// Get object lists from input files
-		file1.for_each_symbol([&f1_objects](std::string symbol, assembly::asm_symbol info) {
-			if (!generated_symbol(symbol) &&
-			    info.m_type != assembly::symbol_type::UNKNOWN)
-				f1_objects.push_back(symbol);
+		parallel_for(work.size(), opts.jobs, [this, &work, &opts](size_t idx) {
+			compare_flat(m_file1, m_file2, *work[idx].first,
+				     *work[idx].second, &opts);
 		});
+	}
 
-		std::sort(f1_objects.begin(), f1_objects.end());
+	const struct flat_result& get(const flat_key &key)
+	{
+		auto it = m_results.find(key);
 
-		file2.for_each_symbol([&f2_objects](std::string symbol, assembly::asm_symbol info) {
-			if (!generated_symbol(symbol) &&
-			    info.m_type != assembly::symbol_type::UNKNOWN)
-				f2_objects.push_back(symbol);
-		});
+		if (it == m_results.end()) {
+			it = m_results.emplace(key, flat_result()).first;
+			compare_flat(m_file1, m_file2, key, it->second, nullptr);
+		}
+
+		return it->second;
+	}
+};
+
+// Dependency graph of the symbols compared so far. Every pair of
+// symbols is a single node, which is shared by all chains that reach
+// it, so each pair is compared and its references are followed once.
+class diff_graph {
+private:
+	enum class state {
+		NEW,
+		ACTIVE,		// References are being compared
+		DONE,
+	};
+
+	struct node {
+		assembly::symbol_type	type;
+		std::string		symbol1;
+		std::string		symbol2;
+		bool			flat_diff;	// No differences in the symbol itself
+		bool			deep_diff;	// Nor in anything it references
+		enum state		state;
+
+		// Referenced nodes and their deep_diff as seen from this
+		// node. References back to an active node count as equal,
+		// which also keeps cycles out of the printed chains.
+		std::vector<std::pair<size_t, bool>> deps;
+
+		node(assembly::symbol_type t, const std::string &s1, const std::string &s2)
+			: type(t), symbol1(s1), symbol2(s2), flat_diff(true),
+			  deep_diff(true), state(state::NEW)
+		{
+		}
+	};
+
+	const assembly::asm_file			&m_file1;
+	const assembly::asm_file			&m_file2;
+	flat_cache					&m_cache;
+	std::vector<node>				m_nodes;
+	std::map<std::pair<std::string, std::string>, size_t>	m_index;
+
+	size_t get_node(assembly::symbol_type type,
+			const std::string &symbol1,
+			const std::string &symbol2)
+	{
+		auto ret = m_index.emplace(std::make_pair(symbol1, symbol2), m_nodes.size());
+
+		if (ret.second)
+			m_nodes.emplace_back(type, symbol1, symbol2);
 
-		std::sort(f2_objects.begin(), f2_objects.end());
+		return ret.first->second;
+	}
 
-		// Now check the functions and diff them
-		for (auto it = f2_objects.begin(), end = f2_objects.end(); it != end; ++it) {
+public:
+	diff_graph(const assembly::asm_file &file1,
+		   const assembly::asm_file &file2,
+		   flat_cache &cache)
+		: m_file1(file1), m_file2(file2), m_cache(cache)
+	{
+	}
 
-			auto obj_type = assembly::symbol_type::FUNCTION;
-			std::string type_str = " function: ";
+	// Compares the two symbols and everything they reference, and
+	// returns the node for them
+	size_t compare(assembly::symbol_type type,
+		       const std::string &symbol1,
+		       const std::string &symbol2)
+	{
+		struct frame {
+			size_t						idx;
+			const assembly::symbol_map			*map;
+			assembly::symbol_map::const_iterator		it;
+		};
+		std::vector<frame> work;
+		size_t root = get_node(type, symbol1, symbol2);
+
+		auto start = [this, &work](size_t idx) {
+			node &n = m_nodes[idx];
+			const struct flat_result &flat =
+				m_cache.get(flat_key(n.symbol1, n.symbol2, n.type));
+
+			if (flat.valid && !flat.flat_diff) {
+				n.flat_diff = false;
+				n.deep_diff = false;
+			}
 
-			if (file2.has_object(*it)) {
-				obj_type = assembly::symbol_type::OBJECT;
-				type_str = " object: ";
+			if (flat.valid && flat.flat_diff && !flat.map.empty()) {
+				n.state = state::ACTIVE;
+				work.push_back({ idx, &flat.map, flat.map.begin() });
+			} else {
+				n.state = state::DONE;
 			}
+		};
 
-			if (!binary_search(f1_objects.begin(), f1_objects.end(), *it)) {
-				changes = true;
-				std::cout << "New" << std::setw(17) << type_str << *it << std::endl;
+		if (m_nodes[root].state == state::NEW)
+			start(root);
+
+		while (!work.empty()) {
+			frame &f = work.back();
+
+			if (f.it == f.map->end()) {
+				node &n = m_nodes[f.idx];
+
+				for (auto &dep : n.deps) {
+					const node &d = m_nodes[dep.first];
+
+					dep.second = d.state == state::ACTIVE || d.deep_diff;
+					n.deep_diff = n.deep_diff && dep.second;
+				}
+
+				n.state = state::DONE;
+				work.pop_back();
+				continue;
+			}
+
+			// The map is keyed by the symbols of the second file
+			const std::string &name1 = f.it->second;
+			const std::string &name2 = f.it->first;
+			const assembly::asm_symbol *sym1 = m_file1.find_symbol(name1);
+			const assembly::asm_symbol *sym2 = m_file2.find_symbol(name2);
+			size_t parent = f.idx;
+
+			++f.it;
+
+			if (sym1 == nullptr || sym1->m_type == assembly::symbol_type::UNKNOWN)
+				continue;
+
+			if (sym2 == nullptr || sym2->m_type != sym1->m_type)
+				continue;
+
+			size_t idx = get_node(sym1->m_type, name1, name2);
+
+			m_nodes[parent].deps.emplace_back(idx, true);
+
+			// May invalidate f
+			if (m_nodes[idx].state == state::NEW)
+				start(idx);
+		}
+
+		return root;
+	}
+
+	bool flat_diff(size_t idx) const
+	{
+		return m_nodes[idx].flat_diff;
+	}
+
+	bool deep_diff(size_t idx) const
+	{
+		return m_nodes[idx].deep_diff;
+	}
+
+private:
+	// Visits the chains of changed symbols below a node in print order.
+	// Nodes that were already visited are not expanded again.
+	void walk_chain(size_t root, std::function<void(const node&, size_t)> handler) const
+	{
+		std::vector<std::pair<size_t, size_t>> work;
+		std::vector<bool> printed(m_nodes.size(), false);
+
+		work.emplace_back(root, 0);
+
+		while (!work.empty()) {
+			size_t idx   = work.back().first;
+			size_t depth = work.back().second;
+			const node &n = m_nodes[idx];
+
+			work.pop_back();
+
+			handler(n, depth);
+
+			if (printed[idx])
 				continue;
+
+			printed[idx] = true;
+
+			for (auto dep = n.deps.rbegin(), end = n.deps.rend(); dep != end; ++dep) {
+				if (dep->second == false)
+					work.emplace_back(dep->first, depth + 1);
 			}
+		}
+	}
+
+public:
+	void print_chain(size_t root, const std::string &indent, std::ostream &os) const
+	{
+		walk_chain(root, [&indent, &os](const node &n, size_t depth) {
+			os << indent << std::string(depth * 4, ' ') << "-> " << n.symbol2;
+			if (n.symbol1 != n.symbol2)
+				os << " (was " << n.symbol1 << ")";
+			os << "[" << (n.type == assembly::symbol_type::FUNCTION ? 'f' : 'o')
+			   << (n.flat_diff ? "=" : "!") << "]" << '\n';
+		});
+	}
+
+	// The chain as a JSON array of nodes in print order
+	void print_chain(size_t root, json_writer &json) const
+	{
+		json.begin_array();
+
+		walk_chain(root, [&json](const node &n, size_t depth) {
+			json.begin_object();
+			json.key("symbol").value(n.symbol2);
+			if (n.symbol1 != n.symbol2)
+				json.key("was").value(n.symbol1);
+			json.key("kind").value(type_name(n.type));
+			json.key("equal").value(n.flat_diff);
+			json.key("depth").value(uint64_t(depth));
+			json.end_object();
+		});
+
+		json.end_array();
+	}
+};
+
+// Reports the differences between two loaded files to os, returns
+// true if anything changed. With the JSON formats every change is a
+// record instead, which names the file if path is not empty.
+static bool diff_loaded(const assembly::asm_file &file1,
+			const assembly::asm_file &file2,
+			const struct diff_options &opts,
+			std::ostream &os,
+			record_writer &records,
+			const std::string &path)
+{
+	std::vector<std::string> f1_objects, f2_objects;
+	bool text = opts.format == output_format::TEXT;
+	bool changes = false;
+
+	auto record = [&records, &path](const std::string &symbol,
+					enum assembly::symbol_type type,
+					const char *status) -> json_writer& {
+		json_writer &json = records.begin();
+
+		json.begin_object();
+		if (!path.empty())
+			json.key("file").value(path);
+		json.key("symbol").value(symbol);
+		json.key("kind").value(type_name(type));
+		json.key("status").value(status);
+
+		return json;
+	};
+
+	// Get object lists from input files
+	file1.for_each_symbol([&f1_objects](const std::string &symbol, const assembly::asm_symbol &info) {
+		if (!generated_symbol(symbol) &&
+		    info.m_type != assembly::symbol_type::UNKNOWN)
+			f1_objects.push_back(symbol);
+	});
+
+	std::sort(f1_objects.begin(), f1_objects.end());
+
+	file2.for_each_symbol([&f2_objects](const std::string &symbol, const assembly::asm_symbol &info) {
+		if (!generated_symbol(symbol) &&
+		    info.m_type != assembly::symbol_type::UNKNOWN)
+			f2_objects.push_back(symbol);
+	});
+
+	std::sort(f2_objects.begin(), f2_objects.end());
 
-			std::unique_ptr<assembly::asm_object> fn1(nullptr);
-			std::unique_ptr<assembly::asm_object> fn2(nullptr);
+	// Diff all symbols present in both files in parallel
+	flat_cache cache(file1, file2);
+	std::vector<flat_key> keys;
 
-			if (obj_type == assembly::symbol_type::FUNCTION) {
-				fn1 = std::unique_ptr<assembly::asm_object>(file1.get_function(*it, oflags));
-				fn2 = std::unique_ptr<assembly::asm_object>(file2.get_function(*it, oflags));
+	for (auto it = f2_objects.begin(), end = f2_objects.end(); it != end; ++it) {
+		if (!binary_search(f1_objects.begin(), f1_objects.end(), *it))
+			continue;
+
+		keys.emplace_back(*it, *it, file2.find_symbol(*it)->m_type);
+	}
+
+	cache.prefetch(keys, opts);
+
+	diff_graph graph(file1, file2, cache);
+
+	// Now check the functions and report the diffs in order
+	for (auto it = f2_objects.begin(), end = f2_objects.end(); it != end; ++it) {
+
+		auto obj_type = file2.find_symbol(*it)->m_type;
+		std::string type_str = " function: ";
+
+		if (obj_type == assembly::symbol_type::OBJECT)
+			type_str = " object: ";
+
+		if (!binary_search(f1_objects.begin(), f1_objects.end(), *it)) {
+			changes = true;
+			if (text) {
+				os << "New" << std::setw(17) << type_str << *it << '\n';
 			} else {
-				fn1 = std::unique_ptr<assembly::asm_object>(file1.get_object(*it, oflags));
-				fn2 = std::unique_ptr<assembly::asm_object>(file2.get_object(*it, oflags));
+				record(*it, obj_type, "new").end_object();
+				records.end();
 			}
+			continue;
+		}
+
+		const struct flat_result &flat = cache.get(flat_key(*it, *it, obj_type));
+
+		if (!flat.valid)
+			continue;
+
+		if (!flat.flat_diff) {
+			changes = true;
+
+			if (!text) {
+				json_writer &json = record(*it, obj_type, "changed");
 
-			if (fn1 == nullptr || fn2 == nullptr)
+				if (opts.show)
+					json.key("hunks").raw(flat.listing);
+				json.end_object();
+				records.end();
 				continue;
+			}
 
-                        unsigned check1 = fn1->elements();
-                        unsigned check2 = fn2->elements();
-                        if (check1 && (std::numeric_limits<unsigned>::max() / check1) < check2) {
-                                // Matrix size overflows, can't be checked
-                                std::cout << "Unhandled:" << std::setw(13) << type_str << *it << std::endl;
-                                continue;
-                        }
+			os << std::left;
+			os << "Changed" << std::setw(13) << type_str << *it << '\n';
 
-			assembly::asm_diff compare(*fn1, *fn2);
+			if (opts.show)
+				os << flat.listing;
+		} else {
+			// Functions are apparently identical - but the
+			// difference might be in the compiler-generated
+			// symbols they reference.  Check for that.
+			size_t node = graph.compare(obj_type, *it, *it);
+
+			if (!graph.deep_diff(node) && !text) {
+				json_writer &json = record(*it, obj_type, "changed");
+
+				json.key("chain");
+				graph.print_chain(node, json);
+				json.end_object();
+				records.end();
+				changes = true;
+			} else if (!graph.deep_diff(node)) {
+				std::ostringstream indent;
+				indent << std::left << std::setw(20) << "";
 
-			if (compare.is_different()) {
 				changes = true;
 
-				results[*it].symbol1 = *it;
-				results[*it].symbol2 = *it;
-				results[*it].flat_diff  = false;
+				os << std::left;
+				os << "Changed" << std::setw(13) << type_str << *it << '\n';
+				os << indent.str() << "(Only referenced compiler-generated symbols changed)";
+				os << '\n';
+				os << indent.str() << "Dependency chain:" << '\n';
+				graph.print_chain(node, indent.str(), os);
+			}
+		}
+	}
 
-				std::cout << std::left;
-				std::cout << "Changed" << std::setw(13) << type_str << *it << std::endl;
+	// Done with the diffs - now search for removed functions
+	for (auto it = f1_objects.begin(), end = f1_objects.end(); it != end; ++it) {
+		auto obj_type = file1.find_symbol(*it)->m_type;
+		std::string type_str = " function: ";
 
-				if (opts.show)
-					print_diff(*fn1, *fn2, compare, opts);
+		if (obj_type == assembly::symbol_type::OBJECT)
+			type_str = " object: ";
+
+		if (!binary_search(f2_objects.begin(), f2_objects.end(), *it)) {
+			changes = true;
+			if (text) {
+				os << "Removed" << std::setw(13) << type_str << *it << '\n';
 			} else {
-				// Functions are apparently identical - but the
-				// difference might be in the compiler-generated
-				// symbols they reference.  Check for that.
-				struct diff_chain chain(obj_type, *it, *it);
-				assembly::symbol_map map;
-
-				results[*it].symbol1 = *it;
-				results[*it].symbol2 = *it;
-				results[*it].flat_diff = true;
-
-				fn2->get_symbol_map(map, *fn1);
-
-				if (!compare_symbol_map(file1, file2, map, results, chain)) {
-					std::ostringstream indent;
-					indent << std::left << std::setw(20) << "";
-
-					changes = true;
-
-					std::cout << std::left;
-					std::cout << "Changed" << std::setw(13) << type_str << *it << std::endl;
-					std::cout << indent.str() << "(Only referenced compiler-generated symbols changed)";
-					std::cout << std::endl;
-					std::cout << indent.str() << "Dependency chain:" << std::endl;
-					print_diff_chain(chain, indent.str());
-				}
+				record(*it, obj_type, "removed").end_object();
+				records.end();
 			}
+			continue;
+		}
+	}
+
+	return changes;
+}
+
+void diff_files(const char *fname1, const char *fname2, struct diff_options &opts)
+{
+	assembly::asm_file file1(fname1);
+	assembly::asm_file file2(fname2);
+
+	try {
+		record_writer records(std::cout, opts.format);
+
+		file1.load(load_flags(opts), opts.jobs);
+		file2.load(load_flags(opts), opts.jobs);
+
+		if (!diff_loaded(file1, file2, opts, std::cout, records, "") &&
+		    opts.format == output_format::TEXT)
+			std::cout << "Nothing changed between files" << '\n';
+
+	} catch (std::runtime_error &e) {
+		diag() << "Error: " << e.what() << std::endl;
+	}
+}
+
+// Input size of the files which are loaded at the same time in tree mode
+static const uintmax_t tree_load_budget = uintmax_t(256) << 20;
+
+// Makes threads wait before loading files until enough of the budget
+// is free. Files larger than the whole budget wait until nothing else
+// is loaded.
+class load_budget {
+private:
+	std::mutex		m_lock;
+	std::condition_variable	m_cond;
+	uintmax_t		m_total;
+	uintmax_t		m_avail;
+
+public:
+	load_budget(uintmax_t total)
+		: m_total(total), m_avail(total)
+	{
+	}
+
+	uintmax_t acquire(uintmax_t bytes)
+	{
+		std::unique_lock<std::mutex> guard(m_lock);
+
+		bytes = std::min(bytes, m_total);
+		m_cond.wait(guard, [this, bytes] { return m_avail >= bytes; });
+		m_avail -= bytes;
+
+		return bytes;
+	}
+
+	void release(uintmax_t bytes)
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_avail += bytes;
 		}
 
-		// Done with the diffs - now search for removed functions
-		for (auto it = f1_objects.begin(), end = f1_objects.end(); it != end; ++it) {
-			std::string type_str = " function: ";
+		m_cond.notify_all();
+	}
+};
+
+// Returns all assembly files below dir with their sizes, indexed by
+// their path relative to dir
+static std::map<std::string, uintmax_t> tree_files(const std::string &dir)
+{
+	std::map<std::string, uintmax_t> files;
+
+	for (auto &entry : std::filesystem::recursive_directory_iterator(dir)) {
+		if (!entry.is_regular_file() || entry.path().extension() != ".s")
+			continue;
+
+		files[entry.path().lexically_relative(dir).string()] = entry.file_size();
+	}
 
-			if (file1.has_object(*it))
-				type_str = " object: ";
+	return files;
+}
 
-			if (!binary_search(f2_objects.begin(), f2_objects.end(), *it)) {
+struct tree_entry {
+	std::string	path;
+	uintmax_t	size;
+	bool		changes;
+	bool		done;		// Diffed, protected by the report lock
+	std::string	output;
+	std::string	error;
+
+	tree_entry(std::string p, uintmax_t s)
+		: path(p), size(s), changes(false), done(false)
+	{
+	}
+};
+
+void diff_trees(std::string dir1, std::string dir2, struct diff_options &opts)
+{
+	try {
+		auto files1 = tree_files(dir1);
+		auto files2 = tree_files(dir2);
+		std::map<std::string, size_t> index;
+		std::vector<struct tree_entry> entries;
+		std::set<std::string> paths;
+		bool changes = false;
+
+		for (auto &file : files2) {
+			auto it = files1.find(file.first);
+
+			if (it == files1.end())
+				continue;
+
+			index[file.first] = entries.size();
+			entries.emplace_back(file.first, file.second + it->second);
+		}
+
+		// Large files first, so that they don't end up last on a
+		// single thread
+		std::vector<size_t> order(entries.size());
+
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&entries](size_t a, size_t b) {
+			return entries[a].size > entries[b].size;
+		});
+
+		// Files are parsed and diffed in parallel, not the symbols
+		// within them
+		struct diff_options file_opts = opts;
+		load_budget budget(tree_load_budget);
+		std::condition_variable cond;
+		std::exception_ptr error;
+		bool finished = false;
+		std::mutex lock;
+
+		file_opts.jobs = 1;
+
+		auto diff_entry = [&](size_t idx) {
+			struct tree_entry &entry = entries[order[idx]];
+			struct release_guard {
+				load_budget	&budget;
+				uintmax_t	bytes;
+
+				~release_guard()
+				{
+					budget.release(bytes);
+				}
+			} guard { budget, budget.acquire(entry.size) };
+
+			try {
+				assembly::asm_file file1(dir1 + "/" + entry.path);
+				assembly::asm_file file2(dir2 + "/" + entry.path);
+				std::ostringstream os;
+
+				file1.load(load_flags(file_opts), file_opts.jobs);
+				file2.load(load_flags(file_opts), file_opts.jobs);
+
+				// Records are put together in path order below
+				{
+					record_writer records(os, file_opts.format == output_format::TEXT ?
+								  output_format::TEXT :
+								  output_format::NDJSON);
+
+					entry.changes = diff_loaded(file1, file2, file_opts, os,
+								    records, entry.path);
+				}
+				entry.output  = os.str();
+			} catch (std::runtime_error &e) {
+				entry.error = e.what();
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				entry.done = true;
+			}
+
+			cond.notify_all();
+		};
+
+		// This thread only writes the report, so that std::cout stays
+		// on one thread
+		std::thread scheduler([&] {
+			try {
+				parallel_for(order.size(), opts.jobs, diff_entry);
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				finished = true;
+			}
+
+			cond.notify_all();
+		});
+
+		// The workers never wait for the report, so this returns
+		// even when the report is cut short
+		struct join_guard {
+			std::thread	&thread;
+
+			~join_guard()
+			{
+				if (thread.joinable())
+					thread.join();
+			}
+		} join { scheduler };
+
+		// Report in order of the paths, each file as soon as it and
+		// all paths before it are done
+		for (auto &file : files1)
+			paths.insert(file.first);
+		for (auto &file : files2)
+			paths.insert(file.first);
+
+		record_writer records(std::cout, opts.format);
+		bool text = opts.format == output_format::TEXT;
+
+		auto file_record = [&records](const std::string &path, const char *status) {
+			json_writer &json = records.begin();
+
+			json.begin_object();
+			json.key("file").value(path);
+			json.key("status").value(status);
+			json.end_object();
+			records.end();
+		};
+
+		std::cout << std::left;
+
+		for (auto &path : paths) {
+			if (!files1.count(path)) {
+				changes = true;
+				if (text)
+					std::cout << std::setw(20) << "New file:" << path << '\n';
+				else
+					file_record(path, "new");
+				continue;
+			}
+
+			if (!files2.count(path)) {
 				changes = true;
-				std::cout << "Removed" << std::setw(13) << type_str << *it << std::endl;
+				if (text)
+					std::cout << std::setw(20) << "Removed file:" << path << '\n';
+				else
+					file_record(path, "removed");
 				continue;
 			}
+
+			struct tree_entry &entry = entries[index[path]];
+
+			{
+				std::unique_lock<std::mutex> guard(lock);
+
+				// Pass on what is there while waiting
+				if (!entry.done && !finished)
+					std::cout.flush();
+
+				cond.wait(guard, [&] { return entry.done || finished; });
+
+				if (!entry.done)
+					break;
+			}
+
+			if (!entry.error.empty()) {
+				diag() << "Error: " << path << ": " << entry.error << std::endl;
+				continue;
+			}
+
+			if (entry.changes) {
+				changes = true;
+				if (text) {
+					std::cout << std::setw(20) << "Changed file:" << path << '\n';
+					std::cout << entry.output;
+				} else {
+					file_record(path, "changed");
+					records.append(entry.output);
+				}
+			}
+
+			// Printed, so the listing can go
+			std::string().swap(entry.output);
 		}
 
-		if (!changes)
-			std::cout << "Nothing changed between files" << std::endl;
+		scheduler.join();
+
+		if (error)
+			std::rethrow_exception(error);
+
+		if (!changes && text)
+			std::cout << "Nothing changed between trees" << '\n';
 
 	} catch (std::runtime_error &e) {
-		std::cerr << "Error: " << e.what() << std::endl;
+		diag() << "Error: " << e.what() << std::endl;
 	}
 }
 
@@ -423,8 +965,8 @@ void diff_functions(std::string filename1, std::string filename2,
 		assembly::asm_file file1(filename1.c_str());
 		assembly::asm_file file2(filename2.c_str());
 
-		file1.load();
-		file2.load();
+		file1.load(load_flags(opts), opts.jobs);
+		file2.load(load_flags(opts), opts.jobs);
 
 		type1 = type2 = assembly::symbol_type::UNKNOWN;
 
@@ -457,9 +999,26 @@ void diff_functions(std::string filename1, std::string filename2,
 			obj2 = std::unique_ptr<assembly::asm_object>(file2.get_object(objname2, oflags));
 		}
 
-		assembly::asm_diff compare(*obj1, *obj2);
-
-		if (compare.is_different()) {
+		assembly::asm_diff compare(*obj1, *obj2, opts.algorithm);
+
+		if (opts.format != output_format::TEXT) {
+			record_writer records(std::cout, opts.format);
+			json_writer &json = records.begin();
+			bool changed = compare.is_different();
+
+			json.begin_object();
+			json.key("symbol").value(objname2);
+			if (objname1 != objname2)
+				json.key("was").value(objname1);
+			json.key("kind").value(type_name(type1));
+			json.key("status").value(changed ? "changed" : "equal");
+			if (changed) {
+				json.key("hunks");
+				print_diff_json(json, *obj1, *obj2, compare, opts);
+			}
+			json.end_object();
+			records.end();
+		} else if (compare.is_different()) {
 			// Print header of diff
 			if (opts.pretty) {
 				if (objname1.size() >= 40)
@@ -470,17 +1029,17 @@ void diff_functions(std::string filename1, std::string filename2,
 
 				std::cout << std::left;
 				std::cout << "         " << std::setw(40) << objname1 << "| " << objname2;
-				std::cout << std::endl;
+				std::cout << '\n';
 			} else {
-				std::cout << objname2 << " (was/is " << objname1 << "):" << std::endl;
+				std::cout << objname2 << " (was/is " << objname1 << "):" << '\n';
 			}
 
-			print_diff(*obj1, *obj2, compare, opts);
+			print_diff(std::cout, *obj1, *obj2, compare, opts);
 		} else {
 			std::cout << base_name(filename1) << ":" << objname1 << " and "
-				  << base_name(filename2) << ":" << objname2 << " are indentical" << std::endl;
+				  << base_name(filename2) << ":" << objname2 << " are indentical" << '\n';
 		}
 	} catch (std::runtime_error &e) {
-		std::cerr << "Error: " << e.what() << std::endl;
+		diag() << "Error: " << e.what() << std::endl;
 	}
 }
@@ -16,16 +16,24 @@
 #include <string>
 #include <map>
 
+#include "generic-diff.h"
+#include "output.h"
+
 struct diff_options {
 	bool show;
 	bool pretty;
 	bool color;
+	bool skip_debug;
 	int context;
+	enum diff::algorithm algorithm;
+	unsigned jobs;
+	enum output_format format;
 
 	diff_options();
 };
 
 void diff_files(const char*, const char*, struct diff_options&);
+void diff_trees(std::string, std::string, struct diff_options&);
 void diff_functions(std::string, std::string, std::string, std::string,
 		    struct diff_options&);
 
@@ -13,11 +13,25 @@
 #ifndef __GENERICDIFF_H
 #define __GENERICDIFF_H
 
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace diff {
 
-	using size_type = unsigned;
+	using size_type = std::uint64_t;
+
+	enum class algorithm {
+		MYERS,		// O((N+M)D) shortest edit script
+		LCS,		// Full LCS matrix
+		HIRSCHBERG,	// LCS in linear space
+	};
+
+	// LCS matrices larger than this are computed in linear space
+	// instead, which gives the same result
+	static const size_type lcs_matrix_limit = size_type(1) << 28;
 
 	enum class diff_type {
 		EQUAL,
@@ -31,6 +45,247 @@ namespace diff {
 		size_type	idx_b;
 	};
 
+	// Edit script with one 2-bit diff_type code per step. The indices
+	// of a step follow from the steps before it, so they are computed
+	// on the fly while iterating.
+	class edit_script {
+	private:
+		std::vector<std::uint64_t>	m_codes;
+		size_type			m_size;
+
+		void set(size_type pos, enum diff_type type)
+		{
+			std::uint64_t &word = m_codes[pos / 32];
+			unsigned shift = (pos % 32) * 2;
+
+			word = (word & ~(std::uint64_t(3) << shift)) |
+			       (std::uint64_t(type) << shift);
+		}
+
+	public:
+		class iterator {
+		private:
+			const edit_script	*m_script;
+			size_type		m_pos;
+			struct diff_element	m_element;
+
+		public:
+			iterator()
+				: m_script(nullptr), m_pos(0),
+				  m_element{ diff_type::EQUAL, 0, 0 }
+			{
+			}
+
+			iterator(const edit_script *script, size_type pos,
+				 size_type idx_a, size_type idx_b)
+				: m_script(script), m_pos(pos),
+				  m_element{ diff_type::EQUAL, idx_a, idx_b }
+			{
+				if (pos < script->size())
+					m_element.type = script->type(pos);
+			}
+
+			size_type pos() const
+			{
+				return m_pos;
+			}
+
+			const struct diff_element& operator*() const
+			{
+				return m_element;
+			}
+
+			const struct diff_element* operator->() const
+			{
+				return &m_element;
+			}
+
+			iterator& operator++()
+			{
+				if (m_element.type != diff_type::ADDED)
+					m_element.idx_a += 1;
+				if (m_element.type != diff_type::REMOVED)
+					m_element.idx_b += 1;
+				if (++m_pos < m_script->size())
+					m_element.type = m_script->type(m_pos);
+
+				return *this;
+			}
+
+			bool operator==(const iterator &other) const
+			{
+				return m_pos == other.m_pos;
+			}
+
+			bool operator!=(const iterator &other) const
+			{
+				return m_pos != other.m_pos;
+			}
+		};
+
+		edit_script()
+			: m_codes(), m_size(0)
+		{
+		}
+
+		void push(enum diff_type type, size_type count = 1)
+		{
+			for (size_type i = 0; i < count; ++i) {
+				if (m_size % 32 == 0)
+					m_codes.push_back(0);
+				set(m_size++, type);
+			}
+		}
+
+		enum diff_type type(size_type pos) const
+		{
+			return static_cast<enum diff_type>((m_codes[pos / 32] >> ((pos % 32) * 2)) & 3);
+		}
+
+		size_type size() const
+		{
+			return m_size;
+		}
+
+		// Reverse the steps from pos to the end
+		void reverse(size_type pos)
+		{
+			for (size_type end = m_size; pos + 1 < end; ++pos, --end) {
+				enum diff_type t = type(pos);
+
+				set(pos, type(end - 1));
+				set(end - 1, t);
+			}
+		}
+
+		// List removals before additions within each block of
+		// changes, like the LCS traceback mostly does
+		void sort_changes()
+		{
+			size_type pos = 0;
+
+			while (pos < m_size) {
+				size_type removed = 0, added = 0;
+
+				for (; pos < m_size && type(pos) != diff_type::EQUAL; ++pos) {
+					if (type(pos) == diff_type::REMOVED)
+						removed += 1;
+					else
+						added += 1;
+				}
+
+				for (size_type i = pos - removed - added; i < pos - added; ++i)
+					set(i, diff_type::REMOVED);
+				for (size_type i = pos - added; i < pos; ++i)
+					set(i, diff_type::ADDED);
+
+				while (pos < m_size && type(pos) == diff_type::EQUAL)
+					++pos;
+			}
+		}
+
+		iterator begin() const
+		{
+			return iterator(this, 0, 0, 0);
+		}
+
+		iterator end() const
+		{
+			return iterator(this, m_size, 0, 0);
+		}
+	};
+
+	// A run of steps to print with the context around changes. Hunks
+	// other than a leading one are separated from the previous one.
+	// The last hunk can be an empty separator.
+	struct hunk {
+		bool			separated;
+		edit_script::iterator	begin;
+		edit_script::iterator	end;
+	};
+
+	// Splits an edit script into hunks, one at a time. The look-ahead
+	// needed for the context is read from the script as it goes.
+	class hunks {
+	private:
+		const edit_script	&m_script;
+		size_type		m_context;
+		edit_script::iterator	m_it;
+		size_type		m_to_print;
+		bool			m_separator;	// Pending for the next hunk
+
+		bool changed(size_type pos) const
+		{
+			pos = std::min(pos, m_script.size() - 1);
+
+			return m_script.type(pos) != diff_type::EQUAL;
+		}
+
+	public:
+		hunks(const edit_script &script, size_type context)
+			: m_script(script), m_context(context), m_it(script.begin()),
+			  m_to_print(0), m_separator(false)
+		{
+			// Context before the first change if it is near the
+			// start of the script
+			for (size_type i = 0; i < context + 1 && i < script.size(); ++i) {
+				if (changed(i))
+					m_to_print = i + context + 1;
+			}
+		}
+
+		bool next(struct hunk &h)
+		{
+			bool started = false;
+
+			for (; m_it != m_script.end(); ++m_it) {
+				size_type pos = m_it.pos();
+
+				if (m_to_print) {
+					if (!started) {
+						h.separated = m_separator;
+						h.begin     = m_it;
+						started     = true;
+						m_separator = false;
+					}
+					m_to_print -= 1;
+				} else if (started) {
+					h.end = m_it;
+					return true;
+				}
+
+				if (changed(pos + m_context + 1)) {
+					bool separate = !m_to_print;
+
+					m_to_print = (2 * m_context) + 1;
+
+					if (separate) {
+						m_separator = true;
+						if (started) {
+							h.end = ++m_it;
+							return true;
+						}
+					}
+				}
+			}
+
+			if (started) {
+				h.end = m_it;
+				return true;
+			}
+
+			if (m_separator) {
+				h.separated = true;
+				h.begin     = m_it;
+				h.end       = m_it;
+				m_separator = false;
+				return true;
+			}
+
+			return false;
+		}
+	};
+
 	// Interface for diffable content,
 	// T must provide '==' and '!=' operators
 	template<typename T>
@@ -42,131 +297,625 @@ namespace diff {
 
 		// Get specific element
 		virtual const T&  element(size_type) const = 0;
+
+		// Hash of an element, equal elements must have equal hashes
+		virtual std::uint64_t hash(size_type) const
+		{
+			return 0;
+		}
+
+		// Hash over all elements in order, equal sequences must
+		// have equal hashes
+		virtual std::uint64_t content_hash() const
+		{
+			return 0;
+		}
 	};
 
-	class lcs_matrix {
+	// Compares the hashes first, which is much cheaper than comparing
+	// the elements
+	template<typename T>
+	inline bool equal_elements(const diffable<T> &a, size_type idx_a,
+				   const diffable<T> &b, size_type idx_b)
+	{
+		return (a.hash(idx_a) == b.hash(idx_b) &&
+			a.element(idx_a) == b.element(idx_b));
+	}
+
+	// Numbers the elements of two sequences, so that equal elements
+	// get the same id
+	template<typename T>
+	class element_ids {
 	private:
-		size_type		m_x;
-		size_type		m_y;
+		struct rep {
+			const diffable<T>	*seq;
+			size_type		idx;
+		};
+
+		std::unordered_map<std::uint64_t, std::vector<std::uint32_t>>	m_buckets;
+		std::vector<rep>						m_reps;
+
+		void assign(const diffable<T> &seq, std::vector<std::uint32_t> &ids)
+		{
+			size_type size = seq.elements();
 
-		std::unique_ptr<int[]>	m_matrix;
-		std::unique_ptr<bool[]>	m_bool;
+			ids.resize(size);
+
+			for (size_type i = 0; i < size; ++i) {
+				auto &bucket = m_buckets[seq.hash(i)];
+				const T &elem = seq.element(i);
+				bool found = false;
+
+				for (auto id : bucket) {
+					if (m_reps[id].seq->element(m_reps[id].idx) == elem) {
+						ids[i] = id;
+						found = true;
+						break;
+					}
+				}
+
+				if (!found) {
+					ids[i] = m_reps.size();
+					bucket.push_back(ids[i]);
+					m_reps.push_back({ &seq, i });
+				}
+			}
+		}
 
 	public:
-		lcs_matrix(size_type x, size_type y)
-			: m_x(x + 1), m_y(y + 1),
-			  m_matrix(new int[m_x * m_y]), m_bool(new bool[m_x * m_y])
+		std::vector<std::uint32_t>	a;
+		std::vector<std::uint32_t>	b;
+
+		element_ids(const diffable<T> &seq_a, const diffable<T> &seq_b)
 		{
+			assign(seq_a, a);
+			assign(seq_b, b);
+			m_buckets.clear();
 		}
 
-		void set(size_type x, size_type y, size_type value)
+		size_type count() const
 		{
-			m_matrix[(y * m_x) + x] = value;
+			return m_reps.size();
 		}
+	};
+
+	// Bit-parallel LCS length (Allison-Dix, Crochemore et al.). The
+	// pattern is kept as a bit vector, one bit per element, so every
+	// element of the text updates 64 cells of the LCS row per word.
+	// There is no AVX2 variant: the row update is one long addition
+	// whose carry runs through all words in order, so the words can't
+	// be processed side by side.
+	class lcs_bits {
+	private:
+		static constexpr size_type none = ~size_type(0);
+
+		std::vector<size_type>		m_head;		// First position of an id
+		std::vector<size_type>		m_next;		// Next position, same id
+		std::vector<std::uint64_t>	m_v;
+		std::vector<std::uint64_t>	m_mask;
+		size_type			m_length;
 
-		size_type get(size_type x, size_type y) const
+	public:
+		lcs_bits(size_type ids)
+			: m_head(ids, none), m_length(0)
 		{
-			return m_matrix[(y * m_x) + x];
 		}
 
-		void set_bool(size_type x, size_type y, bool value)
+		// The pattern is ids[0, length)
+		void set_pattern(const std::uint32_t *ids, size_type length)
 		{
-			m_bool[(y * m_x) + x] = value;
+			size_type words = (length + 63) / 64;
+
+			m_length = length;
+			m_next.assign(length, none);
+			m_v.assign(words, ~std::uint64_t(0));
+			m_mask.assign(words, 0);
+
+			for (size_type i = length; i > 0; --i) {
+				std::uint32_t id = ids[i - 1];
+
+				m_next[i - 1] = m_head[id];
+				m_head[id] = i - 1;
+			}
 		}
 
-		bool get_bool(size_type x, size_type y) const
+		void clear_pattern(const std::uint32_t *ids)
 		{
-			return m_bool[(y * m_x) + x];
+			for (size_type i = 0; i < m_length; ++i)
+				m_head[ids[i]] = none;
+		}
+
+		// Add one element of the text. Only the rows of the first
+		// limit elements of the pattern are updated.
+		void step(std::uint32_t id, size_type limit = none)
+		{
+			size_type words = std::min<size_type>(m_v.size(), limit / 64 + 1);
+			std::uint64_t carry = 0;
+
+			for (size_type pos = m_head[id]; pos != none; pos = m_next[pos])
+				m_mask[pos / 64] |= std::uint64_t(1) << (pos % 64);
+
+			for (size_type w = 0; w < words; ++w) {
+				std::uint64_t v = m_v[w];
+				std::uint64_t m = m_mask[w];
+				std::uint64_t u = v & m;
+				std::uint64_t t = v + u;
+				std::uint64_t r = t + carry;
+
+				carry  = (t < v) | (r < t);
+				m_v[w] = r | (v & ~m);
+			}
+
+			for (size_type pos = m_head[id]; pos != none; pos = m_next[pos])
+				m_mask[pos / 64] = 0;
+		}
+
+		// LCS length of the first prefix elements of the pattern
+		// and the text seen so far
+		size_type length(size_type prefix = none) const
+		{
+			size_type words, zeros = 0;
+
+			prefix = std::min(prefix, m_length);
+			words  = (prefix + 63) / 64;
+
+			// Bits above the prefix don't count
+			for (size_type w = 0; w < words; ++w) {
+				std::uint64_t v = m_v[w];
+
+				if (w == words - 1 && (prefix % 64) != 0)
+					v |= ~std::uint64_t(0) << (prefix % 64);
+
+				zeros += __builtin_popcountll(~v);
+			}
+
+			return zeros;
+		}
+
+		// True if pattern element pos extends the LCS, that is the
+		// length for prefix pos + 1 is one more than for prefix pos
+		static bool extends(const std::vector<std::uint64_t> &row, size_type pos)
+		{
+			return !((row[pos / 64] >> (pos % 64)) & 1);
+		}
+
+		const std::vector<std::uint64_t>& row() const
+		{
+			return m_v;
+		}
+
+		// Restore the first words of a row saved with row()
+		void set_row(const std::vector<std::uint64_t> &row, size_type words)
+		{
+			std::copy(row.begin(), row.begin() + words, m_v.begin());
+		}
+	};
+
+	// Traceback of the LCS matrix. Only the step taken out of every
+	// cell is kept, packed as 2-bit diff_type codes.
+	class lcs_matrix {
+	private:
+		size_type			m_x;
+		size_type			m_y;
+		std::vector<std::uint64_t>	m_codes;
+
+	public:
+		lcs_matrix(size_type x, size_type y)
+			: m_x(x + 1), m_y(y + 1), m_codes((m_x * m_y + 31) / 32, 0)
+		{
+		}
+
+		void set(size_type x, size_type y, enum diff_type type)
+		{
+			size_type idx = (x * m_y) + y;
+
+			m_codes[idx / 32] |= std::uint64_t(type) << ((idx % 32) * 2);
+		}
+
+		enum diff_type get(size_type x, size_type y) const
+		{
+			size_type idx = (x * m_y) + y;
+
+			return static_cast<enum diff_type>((m_codes[idx / 32] >> ((idx % 32) * 2)) & 3);
 		}
 	};
 
+	// Linear space variant of Myers' algorithm, see "An O(ND) Difference
+	// Algorithm and Its Variations". The middle snake splits the problem
+	// until one side is empty.
 	template<typename T>
-	class diff {
+	class myers {
 	private:
-		lcs_matrix		m_lcs;
 		const diffable<T>	&m_a;
 		const diffable<T>	&m_b;
+		std::vector<long>	m_v1;
+		std::vector<long>	m_v2;
+
+		bool equal(size_type a, size_type b) const
+		{
+			return equal_elements(m_a, a, m_b, b);
+		}
 
-		void create()
+		// Find the point where the forward and reverse paths of
+		// [a0, a1) x [b0, b1) overlap and split the problem there
+		void bisect(edit_script &output,
+			    size_type a0, size_type a1,
+			    size_type b0, size_type b1)
 		{
-			auto size_a = m_a.elements() + 1;
-			auto size_b = m_b.elements() + 1;
-			decltype(size_a) a;
-			decltype(size_b) b;
+			long n = a1 - a0, m = b1 - b0;
+			long max_d = (n + m + 1) / 2;
+			long offset = max_d, length = 2 * max_d + 2;
+			long delta = n - m;
+			bool front = (delta % 2 != 0);
+			long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+			m_v1.assign(length, -1);
+			m_v2.assign(length, -1);
+			m_v1[offset + 1] = 0;
+			m_v2[offset + 1] = 0;
+
+			for (long d = 0; d < max_d; ++d) {
+				// Forward path
+				for (long k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+					long k1_offset = offset + k1;
+					long x1, y1;
+
+					if (k1 == -d || (k1 != d && m_v1[k1_offset - 1] < m_v1[k1_offset + 1]))
+						x1 = m_v1[k1_offset + 1];
+					else
+						x1 = m_v1[k1_offset - 1] + 1;
+
+					y1 = x1 - k1;
+
+					while (x1 < n && y1 < m && equal(a0 + x1, b0 + y1)) {
+						++x1;
+						++y1;
+					}
+
+					m_v1[k1_offset] = x1;
+
+					if (x1 > n) {
+						k1end += 2;
+					} else if (y1 > m) {
+						k1start += 2;
+					} else if (front) {
+						long k2_offset = offset + delta - k1;
+
+						if (k2_offset >= 0 && k2_offset < length && m_v2[k2_offset] != -1) {
+							if (x1 >= n - m_v2[k2_offset]) {
+								split(output, a0, a1, b0, b1, x1, y1);
+								return;
+							}
+						}
+					}
+				}
 
-			for (a = 0; a < size_a; ++a) {
+				// Reverse path
+				for (long k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+					long k2_offset = offset + k2;
+					long x2, y2;
 
-				for (b = 0; b < size_b; ++b) {
+					if (k2 == -d || (k2 != d && m_v2[k2_offset - 1] < m_v2[k2_offset + 1]))
+						x2 = m_v2[k2_offset + 1];
+					else
+						x2 = m_v2[k2_offset - 1] + 1;
 
-					if (a == 0 || b == 0) {
-						m_lcs.set(a, b, 0);
-						continue;
+					y2 = x2 - k2;
+
+					while (x2 < n && y2 < m && equal(a1 - x2 - 1, b1 - y2 - 1)) {
+						++x2;
+						++y2;
 					}
 
-					if (m_a.element(a - 1) == m_b.element(b - 1)) {
-						m_lcs.set(a, b, m_lcs.get(a - 1, b - 1) + 1);
-						m_lcs.set_bool(a, b, true);
-					} else {
-						int ai = m_lcs.get(a - 1, b);
-						int bi = m_lcs.get(a, b - 1);
+					m_v2[k2_offset] = x2;
 
-						m_lcs.set(a, b, std::max(ai, bi));
-						m_lcs.set_bool(a, b, false);
+					if (x2 > n) {
+						k2end += 2;
+					} else if (y2 > m) {
+						k2start += 2;
+					} else if (!front) {
+						long k1_offset = offset + delta - k2;
+
+						if (k1_offset >= 0 && k1_offset < length && m_v1[k1_offset] != -1) {
+							long x1 = m_v1[k1_offset];
+							long y1 = offset + x1 - k1_offset;
+
+							if (x1 >= n - x2) {
+								split(output, a0, a1, b0, b1, x1, y1);
+								return;
+							}
+						}
 					}
 				}
 			}
+
+			// No overlap, nothing is in common
+			output.push(diff_type::REMOVED, a1 - a0);
+			output.push(diff_type::ADDED, b1 - b0);
 		}
 
-		void create_diff(std::vector<diff_element> &output,
-				 size_type a, size_type b) const
+		void split(edit_script &output,
+			   size_type a0, size_type a1,
+			   size_type b0, size_type b1,
+			   long x, long y)
+		{
+			create(output, a0, a0 + x, b0, b0 + y);
+			create(output, a0 + x, a1, b0 + y, b1);
+		}
+
+	public:
+		myers(const diffable<T> &a, const diffable<T> &b)
+			: m_a(a), m_b(b)
+		{
+		}
+
+		void create(edit_script &output,
+			    size_type a0, size_type a1,
+			    size_type b0, size_type b1)
+		{
+			size_type suffix = 0;
+
+			// Common prefix
+			while (a0 < a1 && b0 < b1 && equal(a0, b0)) {
+				output.push(diff_type::EQUAL);
+				++a0;
+				++b0;
+			}
+
+			// Common suffix
+			while (a0 < a1 && b0 < b1 && equal(a1 - 1, b1 - 1)) {
+				--a1;
+				--b1;
+				++suffix;
+			}
+
+			if (a0 == a1) {
+				output.push(diff_type::ADDED, b1 - b0);
+			} else if (b0 == b1) {
+				output.push(diff_type::REMOVED, a1 - a0);
+			} else {
+				bisect(output, a0, a1, b0, b1);
+			}
+
+			output.push(diff_type::EQUAL, suffix);
+		}
+	};
+
+	// LCS in linear space. Instead of splitting at the middle of some
+	// longest path like Hirschberg's algorithm, the columns of b are
+	// halved and the path of the LCS matrix traceback is followed
+	// through them from the end, so the result is the same as with the
+	// full matrix. LCS columns are bit vectors (see lcs_bits) and only
+	// the columns on the left of the halves being traced are kept.
+	template<typename T>
+	class hirschberg {
+	private:
+		element_ids<T>				m_ids;
+		lcs_bits				m_bits;
+		std::vector<std::vector<std::uint64_t>>	m_saved;	// Per depth
+		std::vector<std::uint64_t>		m_prev;
+
+		// Words of a column that hold the first rows
+		size_type words(size_type rows) const
+		{
+			return std::min<size_type>(m_bits.row().size(), (rows + 63) / 64);
+		}
+
+		// Push the traceback steps out of column j, starting at row i,
+		// until the path reaches column j - 1. m_bits holds LCS column
+		// j - 1. Returns the row the path ends in.
+		size_type trace_column(edit_script &output, size_type j, size_type i)
+		{
+			const std::vector<std::uint64_t> &curr = m_bits.row();
+			size_type left, up;
+
+			m_prev.assign(curr.begin(), curr.begin() + words(i));
+			left = m_bits.length(i);
+
+			m_bits.step(m_ids.b[j - 1], i);
+			up = m_bits.length(i);
+
+			// left is L[i][j - 1] and up becomes L[i - 1][j]
+			for (; i > 0; --i) {
+				if (m_ids.a[i - 1] == m_ids.b[j - 1]) {
+					output.push(diff_type::EQUAL);
+					return i - 1;
+				}
+
+				up -= lcs_bits::extends(curr, i - 1);
+
+				if (left >= up) {
+					output.push(diff_type::ADDED);
+					return i;
+				}
+
+				output.push(diff_type::REMOVED);
+				left -= lcs_bits::extends(m_prev, i - 1);
+			}
+
+			output.push(diff_type::ADDED);
+
+			return 0;
+		}
+
+		// Like trace_column() for the columns (j0, j1], starting in
+		// column j1. m_bits holds LCS column j0.
+		size_type trace(edit_script &output, size_type j0, size_type j1,
+				size_type i, size_type depth)
+		{
+			if (j1 - j0 == 1)
+				return trace_column(output, j1, i);
+
+			size_type mid = j0 + (j1 - j0) / 2;
+
+			if (m_saved.size() <= depth)
+				m_saved.resize(depth + 1);
+
+			// Deeper calls may grow m_saved, so no references
+			m_saved[depth].assign(m_bits.row().begin(),
+					      m_bits.row().begin() + words(i));
+
+			for (size_type j = j0; j < mid; ++j)
+				m_bits.step(m_ids.b[j], i);
+
+			i = trace(output, mid, j1, i, depth + 1);
+
+			m_bits.set_row(m_saved[depth], words(i));
+
+			return trace(output, j0, mid, i, depth + 1);
+		}
+
+	public:
+		hirschberg(const diffable<T> &a, const diffable<T> &b)
+			: m_ids(a, b), m_bits(m_ids.count())
+		{
+		}
+
+		// Same result as the LCS traceback of a[0, size_a) and
+		// b[0, size_b)
+		void create(edit_script &output, size_type size_a, size_type size_b)
 		{
-			struct diff_element element;
+			size_type first = output.size();
+			size_type i = size_a;
 
-			if (a > 0 && b > 0 && m_lcs.get_bool(a, b)) {
-				create_diff(output, a - 1, b - 1);
+			if (size_b > 0) {
+				m_bits.set_pattern(m_ids.a.data(), size_a);
+				i = trace(output, 0, size_b, size_a, 0);
+				m_bits.clear_pattern(m_ids.a.data());
+			}
+
+			output.push(diff_type::REMOVED, i);
+			output.reverse(first);
+		}
+	};
 
-				element.type  = diff_type::EQUAL;
-				element.idx_a = a - 1;
-				element.idx_b = b - 1;
+	template<typename T>
+	class diff {
+	private:
+		mutable std::unique_ptr<lcs_matrix>	m_lcs;
+		const diffable<T>		&m_a;
+		const diffable<T>		&m_b;
+		enum algorithm			m_algorithm;
+
+		// Scores are only needed for the previous row, the traceback
+		// takes the match if there is one and prefers additions on ties
+		void create(size_type elements_a, size_type elements_b) const
+		{
+			std::vector<size_type> prev(elements_b + 1, 0);
+			std::vector<size_type> curr(elements_b + 1, 0);
+
+			for (size_type b = 1; b <= elements_b; ++b)
+				m_lcs->set(0, b, diff_type::ADDED);
+
+			for (size_type a = 1; a <= elements_a; ++a) {
+				m_lcs->set(a, 0, diff_type::REMOVED);
+
+				for (size_type b = 1; b <= elements_b; ++b) {
+					if (equal_elements(m_a, a - 1, m_b, b - 1)) {
+						curr[b] = prev[b - 1] + 1;
+						m_lcs->set(a, b, diff_type::EQUAL);
+					} else if (curr[b - 1] >= prev[b]) {
+						curr[b] = curr[b - 1];
+						m_lcs->set(a, b, diff_type::ADDED);
+					} else {
+						curr[b] = prev[b];
+						m_lcs->set(a, b, diff_type::REMOVED);
+					}
+				}
 
-				output.push_back(element);
-			} else if (b > 0 && (a == 0 || m_lcs.get(a, b - 1) >= m_lcs.get(a - 1, b))) {
-				create_diff(output, a, b - 1);
+				std::swap(prev, curr);
+			}
+		}
 
-				element.type  = diff_type::ADDED;
-				element.idx_b = b - 1;
+		void create_diff(edit_script &output,
+				 size_type a, size_type b) const
+		{
+			size_type first = output.size();
 
-				output.push_back(element);
-			} else if (a > 0 && (b == 0 || m_lcs.get(a, b - 1) < m_lcs.get(a - 1, b))) {
-				create_diff(output, a - 1, b);
+			// Walk back from the end and reverse the steps after
+			while (a > 0 || b > 0) {
+				enum diff_type type = m_lcs->get(a, b);
 
-				element.type  = diff_type::REMOVED;
-				element.idx_a = a - 1;
+				if (type != diff_type::ADDED)
+					a -= 1;
+				if (type != diff_type::REMOVED)
+					b -= 1;
 
-				output.push_back(element);
+				output.push(type);
 			}
+
+			output.reverse(first);
 		}
 
 	public:
-		diff(const diffable<T> &a, const diffable<T> &b)
-			: m_lcs(a.elements(), b.elements()), m_a(a), m_b(b)
+		diff(const diffable<T> &a, const diffable<T> &b,
+		     enum algorithm algo = algorithm::MYERS)
+			: m_a(a), m_b(b), m_algorithm(algo)
 		{
-			create();
+			// Fall back to linear space for huge matrices
+			if (m_algorithm == algorithm::LCS &&
+			    (a.elements() + 1) * (b.elements() + 1) > lcs_matrix_limit)
+				m_algorithm = algorithm::HIRSCHBERG;
 		}
 
+		// The sequences differ exactly when their LCS is shorter than
+		// them, so no LCS needs to be computed for this
 		bool is_different() const
 		{
 			auto size_a = m_a.elements();
 			auto size_b = m_b.elements();
 
-			return ((size_a != size_b) || (m_lcs.get(size_a, size_b) != size_a));
+			if (size_a != size_b || m_a.content_hash() != m_b.content_hash())
+				return true;
+
+			for (size_type i = 0; i < size_a; ++i) {
+				if (!equal_elements(m_a, i, m_b, i))
+					return true;
+			}
+
+			return false;
 		}
 
-		std::vector<diff_element> get_diff() const
+		edit_script get_edits() const
 		{
-			std::vector<diff_element> ret;
+			edit_script ret;
+
+			if (m_algorithm == algorithm::LCS ||
+			    m_algorithm == algorithm::HIRSCHBERG) {
+				size_type size_a = m_a.elements(), size_b = m_b.elements();
+				size_type suffix = 0;
+
+				// The traceback matches a common suffix diagonally,
+				// so it doesn't need to be in the matrix
+				while (suffix < size_a && suffix < size_b &&
+				       equal_elements(m_a, size_a - suffix - 1,
+						      m_b, size_b - suffix - 1))
+					++suffix;
+
+				size_a -= suffix;
+				size_b -= suffix;
+
+				if (m_algorithm == algorithm::HIRSCHBERG) {
+					hirschberg<T> engine(m_a, m_b);
+
+					engine.create(ret, size_a, size_b);
+				} else {
+					// The matrix is only needed for the listing
+					if (!m_lcs) {
+						m_lcs.reset(new lcs_matrix(size_a, size_b));
+						create(size_a, size_b);
+					}
 
-			create_diff(ret, m_a.elements(), m_b.elements());
+					create_diff(ret, size_a, size_b);
+				}
+
+				ret.push(diff_type::EQUAL, suffix);
+			} else {
+				myers<T> engine(m_a, m_b);
+
+				engine.create(ret, 0, m_a.elements(), 0, m_b.elements());
+				ret.sort_changes();
+			}
 
 			return ret;
 		}
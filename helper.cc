@@ -10,13 +10,25 @@
  * Author: Joerg Roedel <jroedel@suse.de>
  */
 
+#include <string_view>
+#include <algorithm>
+#include <exception>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "helper.h"
 
-static size_t end_of_string(const std::string &line, size_t start)
+static size_t end_of_string(std::string_view line, size_t start)
 {
 	char c = line[start];
 	size_t len = line.size();
@@ -31,12 +43,12 @@ static size_t end_of_string(const std::string &line, size_t start)
 	start += 1;
 
 	if (start >= len)
-		start = std::string::npos;
+		start = std::string_view::npos;
 
 	return start;
 }
 
-static size_t end_of_comment(const std::string &line, size_t start)
+static size_t end_of_comment(std::string_view line, size_t start)
 {
 	size_t len = line.size();
 
@@ -49,48 +61,61 @@ static size_t end_of_comment(const std::string &line, size_t start)
 	}
 
 	if (start >= len)
-		start = std::string::npos;
+		start = std::string_view::npos;
 
 	return start;
 }
 
-std::string trim(const std::string &line)
+static inline bool is_space(char c)
+{
+	return (c == ' ' || c == '\n' || c == '\t' || c == '\r');
+}
+
+std::string_view trim(std::string_view line)
 {
-	static const char *spaces = " \n\t\r";
-	size_t pos1, pos2;
+	size_t pos1 = 0, pos2 = line.size();
 
-	pos1 = line.find_first_not_of(spaces);
-	pos2 = line.find_last_not_of(spaces);
+	while (pos1 < pos2 && is_space(line[pos1]))
+		++pos1;
 
-	if (pos1 == std::string::npos)
-		return std::string("");
+	if (pos1 == pos2)
+		return std::string_view();
 
-	return line.substr(pos1, pos2-pos1+1);
+	while (is_space(line[pos2 - 1]))
+		--pos2;
+
+	return line.substr(pos1, pos2 - pos1);
 }
 
-std::string strip_comment(std::string line)
+// Returns a view of line without comments. Lines that contain C-Style
+// comments need to be rewritten, the returned view points into buffer
+// in this case. Otherwise buffer is left empty.
+std::string_view strip_comment(std::string_view line, std::string &buffer)
 {
 	size_t pos = 0;
 
+	buffer.clear();
+
 	while (true) {
 		pos = line.find_first_of("#\"'/", pos);
-		if (pos == std::string::npos)
+		if (pos == std::string_view::npos)
 			return line;
 
 		if (line[pos] == '#') {
 			return line.substr(0,pos);
-		} else if (pos + 1 != std::string::npos &&
+		} else if (pos + 1 < line.size() &&
 			 line[pos + 1] == '*') {
 			/* C-Style Comment */
-			std::string l1, l2;
+			std::string l1(line.substr(0, pos));
+			size_t len = l1.size();
 
-			l1 = line.substr(0, pos);
 			pos = end_of_comment(line, pos + 1);
-			if (pos != std::string::npos) {
-				l2 = line.substr(pos);
-				pos = l1.size();
+			if (pos != std::string_view::npos) {
+				l1 += line.substr(pos);
+				pos = len;
 			}
-			line = l1 + l2;
+			buffer.swap(l1);
+			line = buffer;
 		} else {
 			pos = end_of_string(line, pos);
 		}
@@ -99,78 +124,216 @@ std::string strip_comment(std::string line)
 	return line;
 }
 
-std::vector<std::string> split_trim(const char *delim, std::string line, unsigned splits)
+// Splits line at the first delimiter which is not within a string.
+// Returns false when there is no such delimiter, head contains the
+// whole trimmed line then.
+bool split_first(const char *delim, std::string_view line,
+		 std::string_view &head, std::string_view &tail)
 {
-	std::string item, delimiters;
-	std::vector<std::string> items;
-	unsigned num;
-
-	line = trim(line);
+	std::string delimiters(delim);
 
-	delimiters  = delim;
 	delimiters += "\"'";
-	num         = 0;
+	line        = trim(line);
 
-	for (size_t pos = 0; pos != std::string::npos;) {
+	for (size_t pos = 0; pos != std::string_view::npos;) {
 		pos = line.find_first_of(delimiters.c_str(), pos);
-		if (pos == std::string::npos) {
-			item = line;
+		if (pos == std::string_view::npos) {
+			break;
 		} else if (line[pos] == '"' || line[pos] == '\'') {
 			pos = end_of_string(line, pos);
-			if (pos == std::string::npos)
-				item = line;
-			else
-				continue;
 		} else {
-			item = line.substr(0, pos);
-			line = line.substr(pos + 1);
-			num += 1;
-			pos  = 0;
+			head = trim(line.substr(0, pos));
+			tail = trim(line.substr(pos + 1));
+			return true;
 		}
+	}
 
-		items.push_back(trim(item));
+	head = trim(line);
+	tail = std::string_view();
 
-		if (splits && num == splits) {
-			items.push_back(trim(line));
-			break;
+	return false;
+}
+
+// Characters split_statements() needs to look at
+static constexpr bool is_special_char(char c)
+{
+	return (c == '#' || c == '"' || c == '\'' || c == '/' ||
+		c == ';' || c == '\\');
+}
+
+static unsigned special_mask_scalar(const char *p, size_t len)
+{
+	unsigned mask = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		if (is_special_char(p[i]))
+			mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+static const size_t scan_block = 16;
+
+#ifdef __SSE2__
+// Returns a bitmask of the special characters in the first len (at most
+// 16) bytes at p
+static inline unsigned special_mask(const char *p, size_t len)
+{
+	// A 16 byte load which does not cross a page boundary can't fault,
+	// even when it reads beyond the end of the line
+	if (len < scan_block &&
+	    (reinterpret_cast<uintptr_t>(p) & 4095) > 4096 - scan_block)
+		return special_mask_scalar(p, len);
+
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	__m128i m;
+
+	m = _mm_cmpeq_epi8(v, _mm_set1_epi8('#'));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+
+	unsigned mask = _mm_movemask_epi8(m);
+
+	if (len < scan_block)
+		mask &= (1u << len) - 1;
+
+	return mask;
+}
+#else
+static inline unsigned special_mask(const char *p, size_t len)
+{
+	return special_mask_scalar(p, len);
+}
+#endif
+
+static void push_statement(std::vector<std::string_view> &stmts,
+			   std::string_view stmt)
+{
+	stmt = trim(stmt);
+
+	if (!stmt.empty())
+		stmts.push_back(stmt);
+}
+
+// Single pass over a line which does the work of strip_comment() and of
+// repeated split_first(";", ...) calls. Both have different ideas of
+// what a string is ('/' starts one in strip_comment()), so two small
+// state machines run over the special characters of the line.
+// Returns false for lines with C-Style comments, these have to go
+// through strip_comment() first and are then split with comments set
+// to false.
+bool split_statements(std::string_view line, std::vector<std::string_view> &stmts,
+		      bool comments)
+{
+	const char *data = line.data();
+	size_t len = line.size();
+	size_t cut = len, start = 0;
+	size_t c_skip = 0, s_skip = 0;
+	char c_quote = 0, s_quote = 0;
+
+	stmts.clear();
+
+	for (size_t base = 0; base < len; base += scan_block) {
+		unsigned mask = special_mask(data + base, std::min(scan_block, len - base));
+
+		while (mask) {
+			size_t pos = base + __builtin_ctz(mask);
+			char c = data[pos];
+
+			mask &= mask - 1;
+
+			// Comment stripping
+			if (comments && pos >= c_skip) {
+				if (c_quote) {
+					if (c == '\\')
+						c_skip = pos + 2;
+					else if (c == c_quote)
+						c_quote = 0;
+				} else if (c == '#') {
+					cut = pos;
+					goto out;
+				} else if (c == '"' || c == '\'' || c == '/') {
+					// C-Style comments need the line to be rewritten
+					if (pos + 1 < len && data[pos + 1] == '*')
+						return false;
+					c_quote = c;
+				}
+			}
+
+			// Statement splitting
+			if (pos < s_skip)
+				continue;
+
+			if (s_quote) {
+				if (c == '\\')
+					s_skip = pos + 2;
+				else if (c == s_quote)
+					s_quote = 0;
+			} else if (c == '"' || c == '\'') {
+				s_quote = c;
+			} else if (c == ';') {
+				push_statement(stmts, line.substr(start, pos - start));
+				start = pos + 1;
+			}
 		}
 	}
 
-	return items;
+out:
+	push_statement(stmts, line.substr(start, cut - start));
+
+	return true;
 }
 
-bool generated_symbol(std::string symbol)
+bool generated_symbol(std::string_view symbol)
 {
 	/*
 	 * We consider symbols generated by the compiler
 	 * when they contain a '.'
 	 */
-	return (symbol.find_first_of(".") != std::string::npos);
+	return (symbol.find_first_of(".") != std::string_view::npos);
 }
 
-std::string expand_tab(std::string input)
+std::string expand_tab(std::string_view input)
 {
-	size_t index = 0;
+	std::string output;
 
-	while (true) {
-		index = input.find('\t', index);
-		if (index == std::string::npos)
-			break;
-
-		size_t delta = (4 - (index % 4));
-		const char *d_str;
+	output.reserve(input.size());
 
-		switch (delta) {
-			case 0: d_str = ""; break;
-			case 1: d_str = " "; break;
-			case 2: d_str = "  "; break;
-			case 3: d_str = "   "; break;
-			case 4: d_str = "    "; break;
+	for (auto c : input) {
+		if (c != '\t') {
+			output += c;
+			continue;
 		}
-		input.replace(index, 1, d_str);
+
+		output.append(4 - (output.size() % 4), ' ');
 	}
 
-	return input;
+	return output;
+}
+
+// Same as above, but writes the result to os without building a string
+void expand_tab(std::ostream &os, std::string_view input)
+{
+	size_t column = 0;
+
+	while (!input.empty()) {
+		size_t pos = input.find('\t');
+		std::string_view chunk = input.substr(0, pos);
+
+		os << chunk;
+		column += chunk.size();
+
+		if (pos == std::string_view::npos)
+			break;
+
+		os << std::string_view("    ", 4 - (column % 4));
+		column += 4 - (column % 4);
+		input.remove_prefix(pos + 1);
+	}
 }
 
 std::string base_name(std::string fname)
@@ -192,3 +355,42 @@ std::string base_fn_name(std::string fn_name)
 
 	return fn_name;
 }
+
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)> &fn)
+{
+	std::vector<std::thread> threads;
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex lock;
+
+	auto worker = [&] {
+		size_t idx;
+
+		while ((idx = next++) < count) {
+			try {
+				fn(idx);
+			} catch (...) {
+				std::lock_guard<std::mutex> guard(lock);
+
+				if (!error)
+					error = std::current_exception();
+
+				// Let the other threads run out of work
+				next = count;
+			}
+		}
+	};
+
+	jobs = std::max<size_t>(std::min<size_t>(jobs, count), 1);
+
+	for (unsigned i = 1; i < jobs; ++i)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (auto &t : threads)
+		t.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -13,17 +13,27 @@
 #ifndef __HELPER_H
 #define __HELPER_H
 
+#include <string_view>
+#include <functional>
+#include <ostream>
 #include <string>
 #include <vector>
 
-std::string trim(const std::string &line);
-std::string strip_comment(std::string line);
-std::vector<std::string> split_trim(const char *delim,
-					   std::string line,
-					   unsigned splits = 0);
-bool generated_symbol(std::string symbol);
-std::string expand_tab(std::string input);
+std::string_view trim(std::string_view line);
+std::string_view strip_comment(std::string_view line, std::string &buffer);
+bool split_first(const char *delim, std::string_view line,
+		 std::string_view &head, std::string_view &tail);
+bool split_statements(std::string_view line, std::vector<std::string_view> &stmts,
+		      bool comments = true);
+bool generated_symbol(std::string_view symbol);
+std::string expand_tab(std::string_view input);
+void expand_tab(std::ostream &os, std::string_view input);
 std::string base_name(std::string fname);
 std::string base_fn_name(std::string fn_name);
 
+// Runs fn(0) ... fn(count - 1) on up to jobs threads. Every thread takes
+// the next index when it is done with one, so uneven work is balanced.
+// The first exception thrown by fn is rethrown after all threads ended.
+void parallel_for(size_t count, unsigned jobs, const std::function<void(size_t)> &fn);
+
 #endif
@@ -19,10 +19,90 @@
 #include "assembly.h"
 #include "info.h"
 
-static void print_one_symbol(assembly::asm_file &file,
-			     std::string &sym, assembly::asm_symbol &info,
+static const char *type_name(const assembly::asm_symbol *info)
+{
+	if (info == nullptr)
+		return "unknown";
+
+	switch (info->m_type) {
+	case assembly::symbol_type::FUNCTION:
+		return "function";
+	case assembly::symbol_type::OBJECT:
+		return "object";
+	default:
+		return "unknown";
+	}
+}
+
+static const char *scope_name(const assembly::asm_symbol *info)
+{
+	if (info == nullptr)
+		return "external";
+
+	switch (info->m_scope) {
+	case assembly::symbol_scope::LOCAL:
+		return "local";
+	case assembly::symbol_scope::GLOBAL:
+		return "global";
+	default:
+		return "unknown";
+	}
+}
+
+static std::unique_ptr<assembly::asm_object> symbol_object(assembly::asm_file &file,
+							   const std::string &sym,
+							   const assembly::asm_symbol &info)
+{
+	if (info.m_type == assembly::symbol_type::FUNCTION)
+		return file.get_function(sym, assembly::func_flags::STRIP_DEBUG);
+	else
+		return file.get_object(sym, assembly::func_flags::STRIP_DEBUG);
+}
+
+static void print_one_record(assembly::asm_file &file, record_writer &records,
+			     const std::string &sym, const assembly::asm_symbol &info,
 			     bool verbose)
 {
+	json_writer &json = records.begin();
+
+	json.begin_object();
+	json.key("symbol").value(sym);
+	json.key("type").value(type_name(&info));
+	json.key("scope").value(scope_name(&info));
+
+	if (verbose) {
+		auto obj = symbol_object(file, sym, info);
+
+		json.key("references").begin_array();
+
+		if (obj != nullptr) {
+			for (auto &s : obj->get_symbols()) {
+				const assembly::asm_symbol *ref = file.find_symbol(s);
+
+				json.begin_object();
+				json.key("symbol").value(s);
+				json.key("type").value(type_name(ref));
+				json.key("scope").value(scope_name(ref));
+				json.end_object();
+			}
+		}
+
+		json.end_array();
+	}
+
+	json.end_object();
+	records.end();
+}
+
+static void print_one_symbol(assembly::asm_file &file, record_writer &records,
+			     const std::string &sym, const assembly::asm_symbol &info,
+			     bool verbose)
+{
+	if (records.format() != output_format::TEXT) {
+		print_one_record(file, records, sym, info, verbose);
+		return;
+	}
+
 	std::string scope;
 	std::string type;
 
@@ -52,17 +132,12 @@ static void print_one_symbol(assembly::asm_file &file,
 
 	std::cout << std::left;
 	std::cout << std::setw(10) << type << std::setw(48) << sym;
-	std::cout << " Scope: " << std::setw(10) << scope << std::endl;
+	std::cout << " Scope: " << std::setw(10) << scope << '\n';
 
 	if (!verbose)
 		return;
 
-	std::unique_ptr<assembly::asm_object> obj(nullptr);
-
-	if (info.m_type == assembly::symbol_type::FUNCTION)
-		obj = file.get_function(sym, assembly::func_flags::STRIP_DEBUG);
-	else
-		obj = file.get_object(sym, assembly::func_flags::STRIP_DEBUG);
+	auto obj = symbol_object(file, sym, info);
 
 	if (obj == nullptr)
 		return;
@@ -72,39 +147,40 @@ static void print_one_symbol(assembly::asm_file &file,
 	if (symbols.size() == 0)
 		return;
 
-	std::cout << "    Referenced symbols " << std::endl;
-	std::cout << "    (F - Function, O - Object, G - Global, L - Local, E - External):" << std::endl;
+	std::cout << "    Referenced symbols " << '\n';
+	std::cout << "    (F - Function, O - Object, G - Global, L - Local, E - External):" << '\n';
 
 	for (auto &s : symbols) {
 		char type = '-', scope = 'E';
 
-		if (file.has_symbol(s)) {
-			auto sym = file.get_symbol(s);
+		const assembly::asm_symbol *sym = file.find_symbol(s);
 
-			if (sym.m_type == assembly::symbol_type::FUNCTION)
+		if (sym != nullptr) {
+			if (sym->m_type == assembly::symbol_type::FUNCTION)
 				type = 'F';
-			else if (sym.m_type == assembly::symbol_type::OBJECT)
+			else if (sym->m_type == assembly::symbol_type::OBJECT)
 				type = 'O';
 
-			if (sym.m_scope == assembly::symbol_scope::GLOBAL)
+			if (sym->m_scope == assembly::symbol_scope::GLOBAL)
 				scope = 'G';
-			else if (sym.m_scope == assembly::symbol_scope::LOCAL)
+			else if (sym->m_scope == assembly::symbol_scope::LOCAL)
 				scope = 'L';
 		}
 
-		std::cout << "        " << s << " (" << type << scope << ')' << std::endl;
+		std::cout << "        " << s << " (" << type << scope << ')' << '\n';
 	}
 }
 
-static void print_symbols(assembly::asm_file &file, struct info_options &opts,
-			  std::function<bool(assembly::asm_symbol&)> filter)
+static void print_symbols(assembly::asm_file &file, record_writer &records,
+			  struct info_options &opts,
+			  std::function<bool(const assembly::asm_symbol&)> filter)
 {
-	file.for_each_symbol([&file, &opts, &filter](std::string sym,
-						     assembly::asm_symbol info) {
+	file.for_each_symbol([&file, &records, &opts, &filter](const std::string &sym,
+							       const assembly::asm_symbol &info) {
 		if (!filter(info))
 			return;
 
-		print_one_symbol(file, sym, info, opts.verbose);
+		print_one_symbol(file, records, sym, info, opts.verbose);
 	});
 }
 
@@ -112,41 +188,46 @@ void print_symbol_info(const char *filename, struct info_options opts)
 {
 	assembly::asm_file file(filename);
 
-	file.load();
+	file.load(assembly::load_flags::LAZY);
+
+	record_writer records(std::cout, opts.format);
 
 	if (opts.functions && opts.global)
-	print_symbols(file, opts, [](assembly::asm_symbol &s)
+	print_symbols(file, records, opts, [](const assembly::asm_symbol &s)
 		{ return s.m_type == assembly::symbol_type::FUNCTION &&
 			 s.m_scope == assembly::symbol_scope::GLOBAL; });
 
 	if (opts.functions && opts.local)
-		print_symbols(file, opts, [](assembly::asm_symbol &s)
+		print_symbols(file, records, opts, [](const assembly::asm_symbol &s)
 			{ return s.m_type == assembly::symbol_type::FUNCTION &&
 				 s.m_scope == assembly::symbol_scope::LOCAL; });
 
 	if (opts.objects && opts.global)
-	print_symbols(file, opts, [](assembly::asm_symbol &s)
+	print_symbols(file, records, opts, [](const assembly::asm_symbol &s)
 		{ return s.m_type == assembly::symbol_type::OBJECT &&
 			 s.m_scope == assembly::symbol_scope::GLOBAL; });
 
 	if (opts.objects && opts.local)
-		print_symbols(file, opts, [](assembly::asm_symbol &s)
+		print_symbols(file, records, opts, [](const assembly::asm_symbol &s)
 			{ return s.m_type == assembly::symbol_type::OBJECT &&
 				 s.m_scope == assembly::symbol_scope::LOCAL; });
 }
 
-void print_one_symbol_info(const char *filename, std::string fn_name)
+void print_one_symbol_info(const char *filename, struct info_options opts)
 {
+	const std::string &fn_name = opts.fn_name;
 	assembly::asm_file file(filename);
 
-	file.load();
+	file.load(assembly::load_flags::LAZY);
+
+	const assembly::asm_symbol *info = file.find_symbol(fn_name);
 
-	if (!file.has_function(fn_name)) {
-		std::cerr << "No such function: " << fn_name << std::endl;
+	if (info == nullptr || info->m_type != assembly::symbol_type::FUNCTION) {
+		diag() << "No such function: " << fn_name << std::endl;
 		return;
 	}
 
-	auto info = file.get_symbol(fn_name);
+	record_writer records(std::cout, opts.format);
 
-	print_one_symbol(file, fn_name, info, true);
+	print_one_symbol(file, records, fn_name, *info, true);
 }
@@ -15,6 +15,8 @@
 
 #include <string>
 
+#include "output.h"
+
 struct info_options {
 	bool functions;
 	bool objects;
@@ -22,14 +24,16 @@ struct info_options {
 	bool local;
 	bool verbose;
 	std::string fn_name;
+	enum output_format format;
 
 	inline info_options()
 		: functions(true), objects(false), global(true),
-		  local(false), verbose(false), fn_name()
+		  local(false), verbose(false), fn_name(),
+		  format(output_format::TEXT)
 	{ }
 };
 
 void print_symbol_info(const char*, struct info_options);
-void print_one_symbol_info(const char*, std::string);
+void print_one_symbol_info(const char*, struct info_options);
 
 #endif
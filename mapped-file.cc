@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "mapped-file.h"
+
+mapped_file::mapped_file()
+	: m_data(""), m_size(0), m_mapped(false), m_buffer()
+{
+}
+
+mapped_file::~mapped_file()
+{
+	release();
+}
+
+mapped_file::mapped_file(mapped_file &&other) noexcept
+	: m_data(other.m_data), m_size(other.m_size), m_mapped(other.m_mapped),
+	  m_buffer(std::move(other.m_buffer))
+{
+	other.m_data   = "";
+	other.m_size   = 0;
+	other.m_mapped = false;
+}
+
+mapped_file& mapped_file::operator=(mapped_file &&other) noexcept
+{
+	if (this != &other) {
+		release();
+
+		m_data   = other.m_data;
+		m_size   = other.m_size;
+		m_mapped = other.m_mapped;
+		m_buffer = std::move(other.m_buffer);
+
+		other.m_data   = "";
+		other.m_size   = 0;
+		other.m_mapped = false;
+	}
+
+	return *this;
+}
+
+void mapped_file::release()
+{
+	if (m_mapped)
+		munmap(const_cast<char*>(m_data), m_size);
+
+	m_buffer.reset();
+	m_data   = "";
+	m_size   = 0;
+	m_mapped = false;
+}
+
+void mapped_file::open(const std::string &filename)
+{
+	struct stat st;
+	int fd;
+
+	release();
+
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error(std::string("Can't open input file ") + filename);
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (addr != MAP_FAILED) {
+			madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+			m_data   = static_cast<const char*>(addr);
+			m_size   = st.st_size;
+			m_mapped = true;
+
+			close(fd);
+			return;
+		}
+	}
+
+	// Not mappable - read the whole thing into memory
+	size_t capacity = 1 << 16;
+	std::unique_ptr<char[]> buffer(new char[capacity]);
+	size_t size = 0;
+
+	while (true) {
+		ssize_t ret;
+
+		if (size == capacity) {
+			std::unique_ptr<char[]> tmp(new char[capacity * 2]);
+
+			std::copy(buffer.get(), buffer.get() + size, tmp.get());
+			buffer    = std::move(tmp);
+			capacity *= 2;
+		}
+
+		ret = read(fd, buffer.get() + size, capacity - size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret < 0) {
+			close(fd);
+			throw std::runtime_error("Can't parse input data");
+		}
+
+		if (ret == 0)
+			break;
+
+		size += ret;
+	}
+
+	close(fd);
+
+	m_buffer = std::move(buffer);
+	m_data   = m_buffer.get();
+	m_size   = size;
+}
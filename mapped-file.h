@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __MAPPED_FILE_H
+#define __MAPPED_FILE_H
+
+#include <string_view>
+#include <string>
+#include <memory>
+
+// Read-only view of a whole input file. Regular files are mapped into
+// memory, everything else (pipes, character devices, ...) is read into
+// a private buffer.
+class mapped_file {
+private:
+	const char		*m_data;
+	size_t			m_size;
+	bool			m_mapped;
+	std::unique_ptr<char[]>	m_buffer;
+
+	void release();
+
+public:
+	mapped_file();
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	mapped_file(mapped_file&&) noexcept;
+	mapped_file& operator=(mapped_file&&) noexcept;
+
+	void open(const std::string &filename);
+
+	const char *data() const { return m_data; }
+	size_t size() const { return m_size; }
+	std::string_view view() const { return std::string_view(m_data, m_size); }
+};
+
+#endif
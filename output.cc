@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <iostream>
+#include <cstring>
+#include <thread>
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "output.h"
+
+output_buffer::output_buffer(int fd, size_t size)
+	: m_fd(fd), m_interactive(isatty(fd)), m_size(size),
+	  m_buffer(new char[size])
+{
+	setp(m_buffer.get(), m_buffer.get() + m_size);
+}
+
+output_buffer::~output_buffer()
+{
+	write_out();
+}
+
+// Write out everything in the buffer, returns false on errors
+bool output_buffer::write_out()
+{
+	const char *data = pbase();
+	size_t len = pptr() - pbase();
+
+	while (len > 0) {
+		ssize_t ret = write(m_fd, data, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0) {
+			setp(m_buffer.get(), m_buffer.get() + m_size);
+			return false;
+		}
+
+		data += ret;
+		len  -= ret;
+	}
+
+	setp(m_buffer.get(), m_buffer.get() + m_size);
+
+	return true;
+}
+
+output_buffer::int_type output_buffer::overflow(int_type c)
+{
+	if (!write_out())
+		return traits_type::eof();
+
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+		return traits_type::not_eof(c);
+
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+
+	if (m_interactive && c == '\n' && !write_out())
+		return traits_type::eof();
+
+	return c;
+}
+
+std::streamsize output_buffer::xsputn(const char *s, std::streamsize n)
+{
+	std::streamsize done = 0;
+
+	while (done < n) {
+		std::streamsize room = epptr() - pptr();
+
+		if (room == 0) {
+			if (!write_out())
+				return done;
+			continue;
+		}
+
+		std::streamsize len = std::min(room, n - done);
+
+		memcpy(pptr(), s + done, len);
+		pbump(len);
+		done += len;
+	}
+
+	if (m_interactive && memchr(s, '\n', n) != nullptr && !write_out())
+		return 0;
+
+	return done;
+}
+
+int output_buffer::sync()
+{
+	return write_out() ? 0 : -1;
+}
+
+// Thread that writes std::cout through a buffered_stdout
+static std::thread::id output_thread;
+
+buffered_stdout::buffered_stdout()
+	: m_buffer(STDOUT_FILENO), m_old(std::cout.rdbuf(&m_buffer)),
+	  m_tie(std::cerr.tie(nullptr))
+{
+	// Untied, so that errors of other threads never flush std::cout
+	output_thread = std::this_thread::get_id();
+}
+
+buffered_stdout::~buffered_stdout()
+{
+	std::cout.flush();
+	std::cout.rdbuf(m_old);
+	std::cerr.tie(m_tie);
+	output_thread = std::thread::id();
+}
+
+std::ostream& diag()
+{
+	if (std::this_thread::get_id() == output_thread)
+		std::cout.flush();
+
+	return std::cerr;
+}
+
+json_writer::json_writer(std::ostream &os)
+	: m_os(os), m_empty(), m_key(false)
+{
+}
+
+void json_writer::separate()
+{
+	if (m_key) {
+		m_key = false;
+		return;
+	}
+
+	if (m_empty.empty())
+		return;
+
+	if (!m_empty.back())
+		m_os << ',';
+
+	m_empty.back() = false;
+}
+
+json_writer& json_writer::begin_object()
+{
+	separate();
+	m_os << '{';
+	m_empty.push_back(true);
+
+	return *this;
+}
+
+json_writer& json_writer::end_object()
+{
+	m_os << '}';
+	m_empty.pop_back();
+
+	return *this;
+}
+
+json_writer& json_writer::begin_array()
+{
+	separate();
+	m_os << '[';
+	m_empty.push_back(true);
+
+	return *this;
+}
+
+json_writer& json_writer::end_array()
+{
+	m_os << ']';
+	m_empty.pop_back();
+
+	return *this;
+}
+
+json_writer& json_writer::key(std::string_view name)
+{
+	separate();
+	quote(m_os, name);
+	m_os << ':';
+	m_key = true;
+
+	return *this;
+}
+
+json_writer& json_writer::value(std::string_view str)
+{
+	separate();
+	quote(m_os, str);
+
+	return *this;
+}
+
+json_writer& json_writer::value(const char *str)
+{
+	return value(std::string_view(str));
+}
+
+json_writer& json_writer::value(bool b)
+{
+	separate();
+	m_os << (b ? "true" : "false");
+
+	return *this;
+}
+
+json_writer& json_writer::value(uint64_t num)
+{
+	separate();
+	m_os << num;
+
+	return *this;
+}
+
+json_writer& json_writer::raw(std::string_view json)
+{
+	separate();
+	m_os << json;
+
+	return *this;
+}
+
+// Length of the valid UTF-8 sequence starting at pos, 0 if there is none
+static size_t utf8_length(std::string_view str, size_t pos)
+{
+	unsigned char c = str[pos];
+	unsigned char lo = 0x80, hi = 0xbf;
+	size_t len;
+
+	if (c >= 0xc2 && c <= 0xdf)
+		len = 2;
+	else if (c >= 0xe0 && c <= 0xef)
+		len = 3;
+	else if (c >= 0xf0 && c <= 0xf4)
+		len = 4;
+	else
+		return 0;
+
+	// No overlong forms, surrogates or code points above U+10FFFF
+	if (c == 0xe0)
+		lo = 0xa0;
+	else if (c == 0xed)
+		hi = 0x9f;
+	else if (c == 0xf0)
+		lo = 0x90;
+	else if (c == 0xf4)
+		hi = 0x8f;
+
+	if (str.size() - pos < len)
+		return 0;
+
+	for (size_t i = 1; i < len; ++i) {
+		unsigned char n = str[pos + i];
+
+		if (n < lo || n > hi)
+			return 0;
+
+		lo = 0x80;
+		hi = 0xbf;
+	}
+
+	return len;
+}
+
+// Bytes which are not valid UTF-8 are written as the code points
+// U+0080 to U+00FF, so the output is always valid JSON
+void json_writer::quote(std::ostream &os, std::string_view str)
+{
+	static const char *hex = "0123456789abcdef";
+	size_t start = 0;
+
+	os << '"';
+
+	for (size_t i = 0; i < str.size(); ++i) {
+		unsigned char c = str[i];
+
+		if (c >= 0x80) {
+			size_t len = utf8_length(str, i);
+
+			if (len > 0) {
+				i += len - 1;
+				continue;
+			}
+		} else if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+
+		os << str.substr(start, i - start);
+		start = i + 1;
+
+		switch (c) {
+		case '"':
+			os << "\\\"";
+			break;
+		case '\\':
+			os << "\\\\";
+			break;
+		case '\n':
+			os << "\\n";
+			break;
+		case '\t':
+			os << "\\t";
+			break;
+		default:
+			os << "\\u00" << hex[c >> 4] << hex[c & 15];
+			break;
+		}
+	}
+
+	os << str.substr(start) << '"';
+}
+
+record_writer::record_writer(std::ostream &os, enum output_format format)
+	: m_os(os), m_format(format), m_json(os), m_records(0)
+{
+	if (m_format == output_format::JSON)
+		m_os << '[';
+}
+
+record_writer::~record_writer()
+{
+	if (m_format == output_format::JSON)
+		m_os << (m_records ? "\n]\n" : "]\n");
+}
+
+enum output_format record_writer::format() const
+{
+	return m_format;
+}
+
+void record_writer::separate()
+{
+	if (m_format == output_format::JSON)
+		m_os << (m_records ? ",\n" : "\n");
+
+	m_records += 1;
+}
+
+json_writer& record_writer::begin()
+{
+	separate();
+
+	return m_json;
+}
+
+void record_writer::terminate()
+{
+	if (m_format == output_format::NDJSON)
+		m_os << '\n';
+}
+
+// NDJSON records are flushed as they are completed, so that a consumer
+// at the other end of a pipe gets them right away
+void record_writer::end()
+{
+	terminate();
+
+	if (m_format == output_format::NDJSON)
+		m_os.flush();
+}
+
+void record_writer::append(std::string_view records)
+{
+	while (!records.empty()) {
+		size_t pos = records.find('\n');
+		std::string_view line = records.substr(0, pos);
+
+		if (!line.empty()) {
+			separate();
+			m_os << line;
+			terminate();
+		}
+
+		if (pos == std::string_view::npos)
+			break;
+
+		records.remove_prefix(pos + 1);
+	}
+
+	if (m_format == output_format::NDJSON)
+		m_os.flush();
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <string_view>
+#include <streambuf>
+#include <ostream>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Stream buffer which writes to a file descriptor in large chunks. It
+// is only flushed when full, on flush() and when it is destroyed,
+// unless the descriptor is a terminal. Then every complete line is
+// written right away.
+class output_buffer : public std::streambuf {
+private:
+	int			m_fd;
+	bool			m_interactive;
+	size_t			m_size;
+	std::unique_ptr<char[]>	m_buffer;
+
+	bool write_out();
+
+protected:
+	virtual int_type overflow(int_type c);
+	virtual std::streamsize xsputn(const char *s, std::streamsize n);
+	virtual int sync();
+
+public:
+	output_buffer(int fd, size_t size = 1 << 20);
+	virtual ~output_buffer();
+
+	output_buffer(const output_buffer&) = delete;
+	output_buffer& operator=(const output_buffer&) = delete;
+};
+
+// Routes std::cout through an output_buffer on stdout while it lives.
+// Only the thread that creates it may write to std::cout.
+class buffered_stdout {
+private:
+	output_buffer		m_buffer;
+	std::streambuf		*m_old;
+	std::ostream		*m_tie;
+
+public:
+	buffered_stdout();
+	~buffered_stdout();
+};
+
+// Stream for warnings and errors. On the thread that writes std::cout,
+// pending output is written first, so that both read in order when
+// they end up in the same file.
+std::ostream& diag();
+
+enum class output_format {
+	TEXT,
+	JSON,		// One array of records
+	NDJSON,		// One record per line
+};
+
+// Writes JSON values to a stream and puts the commas between them
+class json_writer {
+private:
+	std::ostream		&m_os;
+	std::vector<bool>	m_empty;	// Per open object or array
+	bool			m_key;		// The next value belongs to a key
+
+	void separate();
+
+public:
+	json_writer(std::ostream &os);
+
+	json_writer& begin_object();
+	json_writer& end_object();
+	json_writer& begin_array();
+	json_writer& end_array();
+
+	json_writer& key(std::string_view);
+	json_writer& value(std::string_view);
+	json_writer& value(const char*);
+	json_writer& value(bool);
+	json_writer& value(uint64_t);
+
+	// Value which is already in JSON
+	json_writer& raw(std::string_view);
+
+	static void quote(std::ostream&, std::string_view);
+};
+
+// Writes records in one of the JSON formats as soon as they are
+// complete. Nothing is written for output_format::TEXT.
+class record_writer {
+private:
+	std::ostream		&m_os;
+	enum output_format	m_format;
+	json_writer		m_json;
+	size_t			m_records;
+
+	void separate();
+	void terminate();
+
+public:
+	record_writer(std::ostream &os, enum output_format format);
+	~record_writer();
+
+	enum output_format format() const;
+
+	// The writer for the next record, which has to be a single
+	// object. end() completes the record.
+	json_writer& begin();
+	void end();
+
+	// Append records written by an NDJSON record_writer
+	void append(std::string_view);
+};
+
+#endif
@@ -0,0 +1,752 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <unordered_map>
+#include <system_error>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parse-cache.h"
+
+namespace assembly {
+
+	static const char cache_magic[8] = { 'A', 'S', 'M', 'C', 'A', 'C', 'H', 'E' };
+
+	// Default size limit of the cache directory in MiB
+	static const uint64_t default_cache_size = 256;
+
+	// A cache file is the header followed by the record stream, the text
+	// of statements which are not part of the input file and the
+	// warnings of the parser, each aligned to 8 bytes. All numbers in
+	// the record stream are LEB128 encoded. It holds:
+	//
+	//   strings:    length, bytes - numbered per file, 0 is ""
+	//   statements: kind (type | deferred << 6 | in_input << 7),
+	//               text (signed delta to the end of the previous input
+	//               statement, or nothing for the next piece of text),
+	//               length, instr, params (count, then per param the
+	//               token count and id << 3 | type per token), then
+	//               per type: TYPE symbol, type; SIZE symbol; SECTION
+	//               name, flags, executable; COMM symbol, alignment, size
+	//   symbols:    name, type | scope << 4, idx, size_idx, section_idx,
+	//               align_idx, type_idx, end_idx
+	//
+	// Update cache_layout whenever any of this changes.
+	struct cache_header {
+		char		magic[8];
+		uint64_t	layout;
+		uint64_t	build;
+		uint32_t	flags;
+		uint32_t	pad;
+		uint64_t	input_size;
+		uint64_t	input_hash;
+		uint64_t	statements;
+		uint64_t	params;
+		uint64_t	tokens;
+		uint64_t	symbols;
+		uint64_t	strings;
+		uint64_t	record_bytes;
+		uint64_t	text_bytes;
+		uint64_t	warning_bytes;
+	};
+
+	static constexpr uint64_t layout_hash(const char *desc)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+
+		for (; *desc; ++desc)
+			hash = (hash ^ static_cast<unsigned char>(*desc)) * 0x100000001b3ull;
+
+		return hash;
+	}
+
+	static constexpr uint64_t cache_layout = layout_hash(
+		"header:magic,layout,build,flags,pad,input_size,input_hash,statements,"
+		"params,tokens,symbols,strings,record_bytes,text_bytes,warning_bytes;"
+		"string:len,bytes;"
+		"statement:kind,text,length,instr,params,type-data;"
+		"symbol:name,type|scope,idx,size_idx,section_idx,align_idx,type_idx,end_idx");
+
+	static size_t align8(size_t pos)
+	{
+		return (pos + 7) & ~size_t(7);
+	}
+
+	// Four independent lanes, so that the multiplications can overlap
+	static uint64_t content_hash(std::string_view data)
+	{
+		const uint64_t prime = 0x9e3779b97f4a7c15ull;
+		uint64_t lane[4] = { data.size(), prime, ~prime, prime * 3 };
+		const char *p = data.data();
+		size_t size = data.size(), i = 0;
+		uint64_t hash = 0;
+
+		for (; i + 32 <= size; i += 32) {
+			for (int l = 0; l < 4; ++l) {
+				uint64_t word;
+
+				memcpy(&word, p + i + 8 * l, 8);
+				lane[l]  = (lane[l] ^ word) * prime;
+				lane[l] ^= lane[l] >> 31;
+			}
+		}
+
+		for (; i < size; ++i)
+			lane[0] = (lane[0] ^ static_cast<unsigned char>(p[i])) * prime;
+
+		for (int l = 0; l < 4; ++l) {
+			hash  = (hash ^ lane[l]) * prime;
+			hash ^= hash >> 29;
+		}
+
+		return hash;
+	}
+
+	// Identifies the running binary, so that a rebuilt parser never
+	// picks up entries written by an older one
+	static uint64_t build_id()
+	{
+		static uint64_t id = [] {
+			struct stat st;
+
+			if (stat("/proc/self/exe", &st) != 0)
+				return uint64_t(0);
+
+			std::string_view data(reinterpret_cast<const char*>(&st.st_mtim),
+					      sizeof(st.st_mtim));
+
+			return content_hash(data) ^ static_cast<uint64_t>(st.st_size);
+		}();
+
+		return id;
+	}
+
+	// The cache is only used when ASMTOOL_CACHE is set. An absolute
+	// path selects the directory, any other value the default one.
+	static std::string cache_dir()
+	{
+		const char *env = getenv("ASMTOOL_CACHE");
+
+		if (!env || !*env)
+			return "";
+
+		if (env[0] == '/')
+			return env;
+
+		env = getenv("XDG_CACHE_HOME");
+		if (env && *env)
+			return std::string(env) + "/asmtool";
+
+		env = getenv("HOME");
+		if (env && *env)
+			return std::string(env) + "/.cache/asmtool";
+
+		return "";
+	}
+
+	static uint64_t cache_size_limit()
+	{
+		const char *env = getenv("ASMTOOL_CACHE_SIZE");
+		uint64_t size = default_cache_size;
+
+		if (env && *env)
+			size = strtoull(env, nullptr, 10);
+
+		return size << 20;
+	}
+
+	// Removes the least recently used entries until the directory is
+	// within its size limit. Entries are touched when they are used.
+	static void evict(const std::string &dir, uint64_t limit)
+	{
+		namespace fs = std::filesystem;
+
+		struct entry {
+			fs::file_time_type	time;
+			fs::path		path;
+			uint64_t		size;
+		};
+
+		std::vector<entry> entries;
+		uint64_t total = 0;
+		std::error_code ec;
+
+		for (auto it = fs::directory_iterator(dir, ec);
+		     !ec && it != fs::directory_iterator(); it.increment(ec)) {
+			if (it->path().extension() != ".bin")
+				continue;
+
+			uint64_t size = it->file_size(ec);
+			auto time = it->last_write_time(ec);
+
+			if (ec) {
+				ec.clear();
+				continue;
+			}
+
+			entries.push_back({ time, it->path(), size });
+			total += size;
+		}
+
+		if (total <= limit)
+			return;
+
+		std::sort(entries.begin(), entries.end(),
+			  [](const entry &a, const entry &b) { return a.time < b.time; });
+
+		for (auto &e : entries) {
+			if (total <= limit)
+				break;
+
+			if (fs::remove(e.path, ec))
+				total -= e.size;
+		}
+	}
+
+	parse_cache::parse_cache(asm_file &file, enum load_flags flags)
+		: m_file(file), m_flags(flags), m_hash(0)
+	{
+		std::string dir = cache_dir();
+		char name[64];
+
+		if (dir.empty())
+			return;
+
+		m_hash = content_hash(m_file.m_input.view());
+
+		// The flags are part of the key, entries store statement
+		// indices and those depend on load_flags::SKIP_DEBUG
+		snprintf(name, sizeof(name), "/%016llx-%x.bin",
+			 static_cast<unsigned long long>(m_hash),
+			 static_cast<unsigned>(m_flags));
+
+		m_path = dir + name;
+	}
+
+	// Hands out the parts of a cache file, checking that they are
+	// within the file
+	class cache_reader {
+	private:
+		const char	*m_data;
+		size_t		m_size;
+		size_t		m_pos;
+
+	public:
+		cache_reader(const char *data, size_t size)
+			: m_data(data), m_size(size), m_pos(0)
+		{
+		}
+
+		template<typename T>
+		const T *array(uint64_t count)
+		{
+			m_pos = align8(m_pos);
+
+			if (m_pos > m_size || count > (m_size - m_pos) / sizeof(T))
+				throw std::runtime_error("Truncated cache file");
+
+			const T *ret = reinterpret_cast<const T*>(m_data + m_pos);
+
+			m_pos += count * sizeof(T);
+
+			return ret;
+		}
+	};
+
+	static void check(bool condition)
+	{
+		if (!condition)
+			throw std::runtime_error("Corrupt cache file");
+	}
+
+	// Decodes the record stream
+	class record_decoder {
+	private:
+		const unsigned char	*m_pos;
+		const unsigned char	*m_end;
+
+	public:
+		record_decoder(const char *data, size_t size)
+			: m_pos(reinterpret_cast<const unsigned char*>(data)),
+			  m_end(m_pos + size)
+		{
+		}
+
+		uint64_t number()
+		{
+			uint64_t value = 0;
+
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				check(m_pos != m_end);
+
+				unsigned char byte = *m_pos++;
+
+				value |= uint64_t(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+					return value;
+			}
+
+			throw std::runtime_error("Corrupt cache file");
+		}
+
+		int64_t signed_number()
+		{
+			uint64_t value = number();
+
+			return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+		}
+
+		std::string_view bytes(uint64_t length)
+		{
+			check(length <= static_cast<uint64_t>(m_end - m_pos));
+
+			std::string_view ret(reinterpret_cast<const char*>(m_pos), length);
+
+			m_pos += length;
+
+			return ret;
+		}
+
+		bool done() const
+		{
+			return m_pos == m_end;
+		}
+	};
+
+	// Encodes the record stream
+	class record_encoder {
+	private:
+		std::string	m_data;
+
+	public:
+		void number(uint64_t value)
+		{
+			while (value >= 0x80) {
+				m_data += static_cast<char>(value | 0x80);
+				value >>= 7;
+			}
+
+			m_data += static_cast<char>(value);
+		}
+
+		void signed_number(int64_t value)
+		{
+			number((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+		}
+
+		void bytes(std::string_view data)
+		{
+			m_data.append(data);
+		}
+
+		const std::string& data() const
+		{
+			return m_data;
+		}
+	};
+
+	bool parse_cache::load()
+	{
+		if (m_path.empty() || access(m_path.c_str(), R_OK) != 0)
+			return false;
+
+		try {
+			mapped_file cache;
+
+			cache.open(m_path);
+
+			cache_reader reader(cache.data(), cache.size());
+			const cache_header *hdr = reader.array<cache_header>(1);
+			std::string_view input = m_file.m_input.view();
+
+			if (memcmp(hdr->magic, cache_magic, sizeof(cache_magic)) != 0 ||
+			    hdr->layout     != cache_layout ||
+			    hdr->build      != build_id() ||
+			    hdr->flags      != static_cast<uint32_t>(m_flags) ||
+			    hdr->input_size != input.size() ||
+			    hdr->input_hash != m_hash)
+				return false;
+
+			auto records = reader.array<char>(hdr->record_bytes);
+			auto text    = reader.array<char>(hdr->text_bytes);
+			auto warn    = reader.array<char>(hdr->warning_bytes);
+
+			record_decoder rec(records, hdr->record_bytes);
+
+			// Every statement and string takes at least one byte of
+			// the stream, so the counts are bounded by its size
+			check(hdr->strings > 0 &&
+			      hdr->strings <= hdr->record_bytes &&
+			      hdr->statements <= hdr->record_bytes &&
+			      hdr->symbols <= hdr->record_bytes &&
+			      hdr->params <= hdr->record_bytes &&
+			      hdr->tokens <= hdr->record_bytes);
+
+			// Map the strings of the cache to ids of this process
+			std::vector<string_id> ids(hdr->strings);
+
+			for (uint64_t i = 0; i < hdr->strings; ++i)
+				ids[i] = string_table::intern(rec.bytes(rec.number()));
+
+			check(ids[0] == 0);
+
+			auto id = [&ids, &rec]() {
+				uint64_t local = rec.number();
+
+				check(local < ids.size());
+				return ids[local];
+			};
+
+			arena alloc;
+			asm_token *token_array = nullptr;
+			asm_param *param_array = nullptr;
+			uint64_t ntokens = 0, nparams = 0;
+
+			if (hdr->tokens)
+				token_array = static_cast<asm_token*>(
+					alloc.allocate(sizeof(asm_token) * hdr->tokens, alignof(asm_token)));
+
+			if (hdr->params)
+				param_array = static_cast<asm_param*>(
+					alloc.allocate(sizeof(asm_param) * hdr->params, alignof(asm_param)));
+
+			std::vector<asm_statement> statements;
+			uint64_t input_pos = 0, text_pos = 0;
+
+			statements.reserve(hdr->statements);
+
+			for (uint64_t i = 0; i < hdr->statements; ++i) {
+				uint64_t kind = rec.number();
+				uint64_t type = kind & 0x3f;
+				bool in_input = kind & 0x80;
+				uint64_t start;
+
+				check(kind <= 0xff && type <= static_cast<uint64_t>(stmt_type::SLEB128));
+
+				if (in_input) {
+					int64_t delta = rec.signed_number();
+
+					check(delta >= -static_cast<int64_t>(input_pos) &&
+					      delta <= static_cast<int64_t>(input.size() - input_pos));
+					start = input_pos + delta;
+				} else {
+					start = text_pos;
+				}
+
+				uint64_t length = rec.number();
+				const char *base = in_input ? input.data() : text;
+				uint64_t limit = in_input ? input.size() : hdr->text_bytes;
+
+				check(start <= limit && length <= limit - start);
+
+				if (in_input)
+					input_pos = start + length;
+				else
+					text_pos = start + length;
+
+				statements.emplace_back(std::string_view(base + start, length),
+							static_cast<enum stmt_type>(type));
+
+				asm_statement &stmt = statements.back();
+
+				stmt.m_instr    = id();
+				stmt.m_deferred = kind & 0x40;
+
+				uint64_t count = rec.number();
+				asm_param *first_param = param_array + nparams;
+
+				check(count <= hdr->params - nparams);
+
+				for (uint64_t p = 0; p < count; ++p) {
+					uint64_t tokens = rec.number();
+					asm_token *first_token = token_array + ntokens;
+
+					check(tokens <= hdr->tokens - ntokens);
+
+					for (uint64_t t = 0; t < tokens; ++t) {
+						uint64_t token = rec.number();
+						uint64_t local = token >> 3;
+
+						check((token & 7) <= static_cast<uint64_t>(token_type::TYPEFLAG) &&
+						      local < ids.size());
+						new (&token_array[ntokens++]) asm_token(ids[local],
+							static_cast<enum token_type>(token & 7));
+					}
+
+					new (&param_array[nparams++]) asm_param(first_token, tokens);
+				}
+
+				stmt.set_params(count ? first_param : nullptr, count);
+
+				switch (stmt.m_type) {
+				case stmt_type::TYPE: {
+					stmt.m_symtype.symbol = id();
+
+					uint64_t symtype = rec.number();
+
+					check(symtype <= static_cast<uint64_t>(symbol_type::UNKNOWN));
+					stmt.m_symtype.type = static_cast<enum symbol_type>(symtype);
+					break;
+				}
+				case stmt_type::SIZE:
+					stmt.m_size.symbol = id();
+					break;
+				case stmt_type::SECTION:
+					stmt.m_section.name       = id();
+					stmt.m_section.flags      = id();
+					stmt.m_section.executable = rec.number();
+					break;
+				case stmt_type::COMM:
+					stmt.m_comm.symbol    = id();
+					stmt.m_comm.alignment = rec.number();
+					stmt.m_comm.size      = rec.number();
+					break;
+				default:
+					break;
+				}
+			}
+
+			check(nparams == hdr->params && ntokens == hdr->tokens);
+
+			symbol_table symbol_map;
+			uint64_t nstmts = hdr->statements;
+
+			for (uint64_t i = 0; i < hdr->symbols; ++i) {
+				string_id name = id();
+				uint64_t kind  = rec.number();
+				asm_symbol sym;
+
+				check((kind & 0xf) <= static_cast<uint64_t>(symbol_type::UNKNOWN) &&
+				      (kind >> 4) <= static_cast<uint64_t>(symbol_scope::GLOBAL));
+
+				sym.m_idx         = rec.number();
+				sym.m_size_idx    = rec.number();
+				sym.m_section_idx = rec.number();
+				sym.m_align_idx   = rec.number();
+				sym.m_type_idx    = rec.number();
+				sym.m_end_idx     = rec.number();
+				sym.m_type        = static_cast<enum symbol_type>(kind & 0xf);
+				sym.m_scope       = static_cast<enum symbol_scope>(kind >> 4);
+
+				// All of them index m_statements
+				check(sym.m_idx < nstmts && sym.m_size_idx < nstmts &&
+				      sym.m_section_idx < nstmts && sym.m_align_idx < nstmts &&
+				      sym.m_type_idx < nstmts &&
+				      sym.m_idx <= sym.m_end_idx && sym.m_end_idx <= nstmts);
+
+				// Symbols were written in name order, so the
+				// table needs no sorting
+				symbol_map[name] = sym;
+			}
+
+			check(rec.done());
+
+			m_file.m_statements = std::move(statements);
+			m_file.m_symbols    = std::move(symbol_map);
+			m_file.m_arena.splice(std::move(alloc));
+			m_file.m_cache      = std::move(cache);
+			m_file.m_warnings   = std::string(warn, hdr->warning_bytes);
+		} catch (std::runtime_error &e) {
+			// Parse the input instead
+			return false;
+		}
+
+		// Keep recently used entries from being evicted
+		std::error_code ec;
+
+		std::filesystem::last_write_time(m_path,
+			std::filesystem::file_time_type::clock::now(), ec);
+
+		return true;
+	}
+
+	static void write_bytes(std::ofstream &out, std::string_view data)
+	{
+		static const char zero[8] = { 0 };
+		std::streamoff pos = out.tellp();
+
+		out.write(zero, align8(pos) - pos);
+		out.write(data.data(), data.size());
+	}
+
+	void parse_cache::store() const
+	{
+		static std::atomic<unsigned> counter(0);
+
+		std::unordered_map<string_id, uint32_t> local_ids;
+		std::vector<string_id> strings;
+		record_encoder stmts, rec;
+		std::string text;
+		std::string_view input = m_file.m_input.view();
+		uint64_t input_pos = 0, nparams = 0, ntokens = 0;
+
+		if (m_path.empty())
+			return;
+
+		auto local = [&local_ids, &strings](string_id id) {
+			auto ret = local_ids.emplace(id, strings.size());
+
+			if (ret.second)
+				strings.push_back(id);
+
+			return ret.first->second;
+		};
+
+		local(0);
+
+		for (const asm_statement &stmt : m_file.m_statements) {
+			std::string_view raw = stmt.m_stmt;
+			bool in_input = raw.empty() ||
+					(raw.data() >= input.data() &&
+					 raw.data() + raw.size() <= input.data() + input.size());
+			uint64_t kind = static_cast<uint64_t>(stmt.m_type);
+
+			if (stmt.m_deferred)
+				kind |= 0x40;
+			if (in_input)
+				kind |= 0x80;
+
+			stmts.number(kind);
+
+			if (in_input) {
+				uint64_t start = raw.empty() ? input_pos : raw.data() - input.data();
+
+				stmts.signed_number(static_cast<int64_t>(start - input_pos));
+				input_pos = start + raw.size();
+			} else {
+				text.append(raw);
+			}
+
+			stmts.number(raw.size());
+			stmts.number(local(stmt.m_instr));
+			stmts.number(stmt.m_nparams);
+
+			for (uint32_t i = 0; i < stmt.m_nparams; ++i) {
+				const asm_param &p = stmt.m_params[i];
+
+				stmts.number(p.tokens());
+
+				for (size_t j = 0; j < p.tokens(); ++j) {
+					const asm_token &t = p.token(j);
+
+					stmts.number(uint64_t(local(t.id())) << 3 |
+						     static_cast<uint64_t>(t.type()));
+				}
+
+				ntokens += p.tokens();
+			}
+
+			nparams += stmt.m_nparams;
+
+			switch (stmt.m_type) {
+			case stmt_type::TYPE:
+				stmts.number(local(stmt.m_symtype.symbol));
+				stmts.number(static_cast<uint64_t>(stmt.m_symtype.type));
+				break;
+			case stmt_type::SIZE:
+				stmts.number(local(stmt.m_size.symbol));
+				break;
+			case stmt_type::SECTION:
+				stmts.number(local(stmt.m_section.name));
+				stmts.number(local(stmt.m_section.flags));
+				stmts.number(stmt.m_section.executable);
+				break;
+			case stmt_type::COMM:
+				stmts.number(local(stmt.m_comm.symbol));
+				stmts.number(stmt.m_comm.alignment);
+				stmts.number(stmt.m_comm.size);
+				break;
+			default:
+				break;
+			}
+		}
+
+		for (auto &sym : m_file.m_symbols) {
+			stmts.number(local(sym.first));
+			stmts.number(static_cast<uint64_t>(sym.second.m_type) |
+				     static_cast<uint64_t>(sym.second.m_scope) << 4);
+			stmts.number(sym.second.m_idx);
+			stmts.number(sym.second.m_size_idx);
+			stmts.number(sym.second.m_section_idx);
+			stmts.number(sym.second.m_align_idx);
+			stmts.number(sym.second.m_type_idx);
+			stmts.number(sym.second.m_end_idx);
+		}
+
+		// Strings go first, they are numbered in the order of their
+		// first use above
+		for (string_id id : strings) {
+			const std::string &str = string_table::get(id);
+
+			rec.number(str.size());
+			rec.bytes(str);
+		}
+
+		rec.bytes(stmts.data());
+
+		cache_header hdr;
+
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+
+		hdr.layout        = cache_layout;
+		hdr.build         = build_id();
+		hdr.flags         = static_cast<uint32_t>(m_flags);
+		hdr.input_size    = input.size();
+		hdr.input_hash    = m_hash;
+		hdr.statements    = m_file.m_statements.size();
+		hdr.params        = nparams;
+		hdr.tokens        = ntokens;
+		hdr.symbols       = m_file.m_symbols.size();
+		hdr.strings       = strings.size();
+		hdr.record_bytes  = rec.data().size();
+		hdr.text_bytes    = text.size();
+		hdr.warning_bytes = m_file.m_warnings.size();
+
+		// Write to a private file first, so that concurrent users
+		// never see a partial entry
+		std::error_code ec;
+		std::filesystem::path path(m_path);
+
+		std::filesystem::create_directories(path.parent_path(), ec);
+		if (ec)
+			return;
+
+		std::string tmp = m_path + "." + std::to_string(getpid()) + "." +
+				  std::to_string(counter++);
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+
+		out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+		write_bytes(out, rec.data());
+		write_bytes(out, text);
+		write_bytes(out, m_file.m_warnings);
+		out.close();
+
+		if (!out || rename(tmp.c_str(), m_path.c_str()) != 0) {
+			unlink(tmp.c_str());
+			return;
+		}
+
+		evict(path.parent_path(), cache_size_limit());
+	}
+
+} // namespace assembly
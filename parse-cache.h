@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __PARSE_CACHE_H
+#define __PARSE_CACHE_H
+
+#include <string>
+
+#include "assembly.h"
+
+namespace assembly {
+
+	// On-disk cache of parsed files, only used when ASMTOOL_CACHE is
+	// set in the environment. Entries live in $XDG_CACHE_HOME/asmtool
+	// or ~/.cache/asmtool and are keyed by a hash of the input content
+	// and the load flags. Entries of another record layout or another
+	// build of the tool are ignored. The least recently used entries
+	// are removed when the directory grows beyond ASMTOOL_CACHE_SIZE
+	// MiB (256 by default).
+	class parse_cache {
+	private:
+		asm_file		&m_file;
+		enum load_flags		m_flags;
+		uint64_t		m_hash;
+		std::string		m_path;
+
+	public:
+		// The input of the file must already be mapped
+		parse_cache(asm_file&, enum load_flags);
+
+		// Restore the file from the cache, returns false when
+		// there is no usable entry
+		bool load();
+
+		// Write the loaded file to the cache. This is best effort,
+		// failures are ignored.
+		void store() const;
+	};
+
+} // namespace assembly
+
+#endif
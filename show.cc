@@ -15,31 +15,32 @@
 #include <string>
 
 #include "assembly.h"
+#include "output.h"
 
 void show_symbol(const char *filename, const std::string &symbol)
 {
 	std::unique_ptr<assembly::asm_object> obj(nullptr);
 	assembly::asm_file file(filename);
 
-	file.load();
+	file.load(assembly::load_flags::LAZY);
 
 	if (file.has_function(symbol)) {
 		obj = file.get_function(symbol, assembly::func_flags::STRIP_DEBUG);
 	} else if (file.has_object(symbol)) {
 		obj = file.get_object(symbol, assembly::func_flags::STRIP_DEBUG);
 	} else {
-		std::cerr << "Error: Symbol not found: " << symbol << std::endl;
+		diag() << "Error: Symbol not found: " << symbol << std::endl;
 		return;
 	}
 
-	std::cout << symbol << ":" << std::endl;
+	std::cout << symbol << ":" << '\n';
 
-	obj->for_each_statement([](assembly::asm_statement &stmt) {
+	obj->for_each_statement([](const assembly::asm_statement &stmt) {
 		std::string indent = "\t";
 
 		if (stmt.type() == assembly::stmt_type::LABEL)
 			indent = "";
 
-		std::cout << indent << stmt.raw() << std::endl;
+		std::cout << indent << stmt.raw() << '\n';
 	});
 }
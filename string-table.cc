@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <unordered_map>
+#include <stdexcept>
+#include <mutex>
+
+#include "string-table.h"
+#include "helper.h"
+
+namespace assembly {
+
+	// The table is split into shards with their own lock so that
+	// parallel parsers don't serialize on a single mutex. The shard
+	// number is stored in the low bits of the id.
+	static const unsigned shard_bits = 4;
+	static const unsigned num_shards = 1 << shard_bits;
+
+	// Entries are stored in fixed-size blocks that never move, so
+	// lookups by id don't need to take the lock.
+	static const unsigned block_bits = 10;
+	static const unsigned block_size = 1 << block_bits;
+	static const unsigned max_blocks = 1 << (28 - shard_bits - block_bits);
+
+	struct table_entry {
+		std::string	str;
+		bool		generated;
+	};
+
+	struct table_shard {
+		std::mutex					lock;
+		std::unordered_map<std::string_view, string_id>	index;
+		table_entry					*blocks[max_blocks];
+		uint32_t					count;
+
+		table_shard()
+			: lock(), index(), blocks(), count(0)
+		{
+		}
+
+		// Must be called with the lock held
+		string_id add(std::string_view str, unsigned shard)
+		{
+			uint32_t local = count;
+
+			if ((local >> block_bits) >= max_blocks)
+				throw std::runtime_error("String table overflow");
+
+			table_entry *&block = blocks[local >> block_bits];
+			if (block == nullptr)
+				block = new table_entry[block_size];
+
+			table_entry &e = block[local & (block_size - 1)];
+			e.str       = std::string(str);
+			e.generated = generated_symbol(e.str);
+
+			count += 1;
+
+			return (local << shard_bits) | shard;
+		}
+	};
+
+	struct table {
+		table_shard shards[num_shards];
+
+		table()
+		{
+			// Reserve id 0 for the empty string
+			shards[0].add(std::string_view(), 0);
+		}
+	};
+
+	static table& get_table()
+	{
+		static table t;
+
+		return t;
+	}
+
+	static const table_entry& get_entry(string_id id)
+	{
+		const table_shard &shard = get_table().shards[id & (num_shards - 1)];
+		uint32_t local = id >> shard_bits;
+
+		return shard.blocks[local >> block_bits][local & (block_size - 1)];
+	}
+
+	string_id string_table::intern(std::string_view str)
+	{
+		// Most lookups are for a small set of mnemonics and registers,
+		// keep a per-thread cache in front of the shared table
+		struct cache_entry {
+			size_t		hash;
+			string_id	id;
+		};
+		static thread_local cache_entry cache[1024];
+
+		if (str.empty())
+			return 0;
+
+		size_t hash = std::hash<std::string_view>()(str);
+		cache_entry &c = cache[hash % 1024];
+
+		if (c.hash == hash && get_entry(c.id).str == str)
+			return c.id;
+
+		unsigned idx = (hash >> 7) % num_shards;
+		table_shard &shard = get_table().shards[idx];
+		string_id id;
+
+		{
+			std::lock_guard<std::mutex> guard(shard.lock);
+			auto it = shard.index.find(str);
+
+			if (it != shard.index.end()) {
+				id = it->second;
+			} else {
+				id = shard.add(str, idx);
+				shard.index.emplace(get_entry(id).str, id);
+			}
+		}
+
+		c.hash = hash;
+		c.id   = id;
+
+		return id;
+	}
+
+	bool string_table::lookup(std::string_view str, string_id &id)
+	{
+		if (str.empty()) {
+			id = 0;
+			return true;
+		}
+
+		size_t hash = std::hash<std::string_view>()(str);
+		unsigned idx = (hash >> 7) % num_shards;
+		table_shard &shard = get_table().shards[idx];
+
+		std::lock_guard<std::mutex> guard(shard.lock);
+		auto it = shard.index.find(str);
+
+		if (it == shard.index.end())
+			return false;
+
+		id = it->second;
+
+		return true;
+	}
+
+	const std::string& string_table::get(string_id id)
+	{
+		return get_entry(id).str;
+	}
+
+	bool string_table::generated(string_id id)
+	{
+		return get_entry(id).generated;
+	}
+
+} // namespace assembly
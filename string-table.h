@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __STRING_TABLE_H
+#define __STRING_TABLE_H
+
+#include <string_view>
+#include <cstdint>
+#include <string>
+
+namespace assembly {
+
+	// Interned strings are identified by a 32 bit id. Equal strings
+	// always get the same id, so comparing ids is the same as
+	// comparing the strings. Id 0 is the empty string.
+	using string_id = uint32_t;
+
+	// Process-wide table of interned strings. Interning and lookups
+	// are safe to be called from multiple threads. Strings are never
+	// removed, so references returned by get() stay valid.
+	class string_table {
+	public:
+		static string_id intern(std::string_view);
+
+		// Like intern(), but never adds the string. Returns false
+		// if it was not interned before.
+		static bool lookup(std::string_view, string_id&);
+
+		static const std::string& get(string_id);
+
+		// True if the string is a compiler-generated symbol name,
+		// see generated_symbol()
+		static bool generated(string_id);
+	};
+
+} // namespace assembly
+
+#endif
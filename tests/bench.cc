@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include "../assembly.h"
+#include "sequences.h"
+
+// The benchmarks only report how the run time grows with eight times the
+// input. Linear code takes about eight times as long, a bit more once the
+// data no longer fits the caches, quadratic code 64 times. Nothing fails
+// on the numbers, timings on a loaded machine vary.
+static const size_t factor = 8;
+
+static void report(const char *name, size_t small, double t_small, double t_large)
+{
+	std::cout << name << ": " << small << " in " << t_small << "s, "
+		  << small * factor << " in " << t_large << "s, ratio "
+		  << t_large / std::max(t_small, 1e-6) << std::endl;
+}
+
+// Fastest of a few runs, in seconds
+template<typename F> static double best_of(F run)
+{
+	double best = 1e9;
+
+	for (int i = 0; i < 3; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		run();
+		std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+
+		best = std::min(best, t.count());
+	}
+
+	return best;
+}
+
+// Myers' algorithm with a fixed number of edits
+static void bench_myers(std::mt19937 &rng)
+{
+	const size_t small = 100000, edits = 50;
+	const int alphabet = 1000;
+	double times[2];
+
+	for (int i = 0; i < 2; ++i) {
+		auto seq = random_sequence(rng, i ? small * factor : small, alphabet);
+		int_sequence a(seq);
+		int_sequence b(mutate(rng, seq, edits, alphabet));
+
+		times[i] = best_of([&] {
+			diff::diff<int> d(a, b, diff::algorithm::MYERS);
+			auto edits = d.get_edits();
+		});
+	}
+
+	report("myers", small, times[0], times[1]);
+}
+
+// Writes a function with compiler generated .L labels, each
+// followed by a jump to another one of them
+static std::string write_function(size_t labels)
+{
+	std::string path = (std::filesystem::temp_directory_path() / "asmtool-bench-XXXXXX.s").string();
+	int fd = mkstemps(&path[0], 2);
+
+	if (fd < 0)
+		throw std::runtime_error("Can't create " + path);
+	close(fd);
+
+	std::ofstream out(path);
+
+	out << "\t.text\n\t.globl\tf\n\t.type\tf, @function\nf:\n";
+	for (size_t i = 0; i < labels; ++i) {
+		out << ".L" << i << ":\n";
+		out << "\taddl\t$" << i << ", %eax\n";
+		out << "\tjne\t.L" << (i * 7919) % labels << "\n";
+	}
+	out << "\tret\n\t.size\tf, .-f\n";
+
+	if (!out)
+		throw std::runtime_error("Can't write " + path);
+
+	return path;
+}
+
+// Label normalization of get_function()
+static void bench_normalize()
+{
+	const size_t small = 20000;
+	double times[2];
+
+	for (int i = 0; i < 2; ++i) {
+		std::string path = write_function(i ? small * factor : small);
+		assembly::asm_file file(path);
+
+		file.load();
+		times[i] = best_of([&] {
+			auto fn = file.get_function("f", assembly::func_flags::NORMALIZE);
+		});
+		std::filesystem::remove(path);
+	}
+
+	report("normalize", small, times[0], times[1]);
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+
+	try {
+		bench_myers(rng);
+		bench_normalize();
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
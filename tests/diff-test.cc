@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#include <iostream>
+#include <random>
+
+#include "sequences.h"
+
+static bool same_edits(const diff::edit_script &x, const diff::edit_script &y)
+{
+	if (x.size() != y.size())
+		return false;
+
+	for (auto i = x.begin(), j = y.begin(); i != x.end(); ++i, ++j) {
+		if (i->type != j->type || i->idx_a != j->idx_a || i->idx_b != j->idx_b)
+			return false;
+	}
+
+	return true;
+}
+
+// The linear space mode has to give the same edit script as the full
+// LCS matrix
+static bool test_hirschberg(std::mt19937 &rng)
+{
+	static const size_t sizes[] = { 0, 1, 2, 3, 63, 64, 65, 127, 128, 200, 700 };
+	unsigned failed = 0, runs = 0;
+
+	for (size_t size_a : sizes) {
+		for (size_t size_b : sizes) {
+			for (int alphabet : { 2, 4, 16, 1000 }) {
+				int_sequence a(random_sequence(rng, size_a, alphabet));
+				int_sequence b(random_sequence(rng, size_b, alphabet));
+				diff::diff<int> lcs(a, b, diff::algorithm::LCS);
+				diff::diff<int> linear(a, b, diff::algorithm::HIRSCHBERG);
+
+				runs += 1;
+				if (!same_edits(lcs.get_edits(), linear.get_edits())) {
+					std::cerr << "hirschberg: differs for sizes " << size_a
+						  << "/" << size_b << ", alphabet " << alphabet << std::endl;
+					failed += 1;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < 200; ++i) {
+		int alphabet = 2 + rng() % 50;
+		auto seq = random_sequence(rng, rng() % 2000, alphabet);
+		int_sequence a(seq);
+		int_sequence b(mutate(rng, seq, rng() % 40, alphabet));
+		diff::diff<int> lcs(a, b, diff::algorithm::LCS);
+		diff::diff<int> linear(a, b, diff::algorithm::HIRSCHBERG);
+
+		runs += 1;
+		if (!same_edits(lcs.get_edits(), linear.get_edits())) {
+			std::cerr << "hirschberg: differs for similar sequences of size "
+				  << a.elements() << "/" << b.elements() << std::endl;
+			failed += 1;
+		}
+	}
+
+	std::cout << "hirschberg: " << runs - failed << "/" << runs << " passed" << std::endl;
+
+	return failed == 0;
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+	bool ok = true;
+
+	ok &= test_hirschberg(rng);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2015-2016 SUSE Linux GmbH
+ *
+ * Licensed under the GNU General Public License Version 2
+ * as published by the Free Software Foundation.
+ *
+ * See http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ * for details.
+ *
+ * Author: Joerg Roedel <jroedel@suse.de>
+ */
+
+#ifndef __TESTS_SEQUENCES_H
+#define __TESTS_SEQUENCES_H
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "../generic-diff.h"
+
+class int_sequence : public diff::diffable<int> {
+private:
+	std::vector<int>	m_elements;
+
+public:
+	int_sequence(std::vector<int> elements)
+		: m_elements(std::move(elements))
+	{
+	}
+
+	virtual diff::size_type elements() const
+	{
+		return m_elements.size();
+	}
+
+	virtual const int& element(diff::size_type idx) const
+	{
+		return m_elements[idx];
+	}
+
+	virtual std::uint64_t hash(diff::size_type idx) const
+	{
+		return m_elements[idx];
+	}
+};
+
+inline std::vector<int> random_sequence(std::mt19937 &rng, size_t size, int alphabet)
+{
+	std::vector<int> ret(size);
+
+	for (auto &e : ret)
+		e = rng() % alphabet;
+
+	return ret;
+}
+
+// Apply random edits, so that the sequences are similar
+inline std::vector<int> mutate(std::mt19937 &rng, std::vector<int> seq,
+			       size_t edits, int alphabet)
+{
+	for (size_t i = 0; i < edits; ++i) {
+		size_t pos = seq.empty() ? 0 : rng() % seq.size();
+
+		switch (rng() % 3) {
+		case 0:
+			seq.insert(seq.begin() + pos, rng() % alphabet);
+			break;
+		case 1:
+			if (!seq.empty())
+				seq.erase(seq.begin() + pos);
+			break;
+		default:
+			if (!seq.empty())
+				seq[pos] = rng() % alphabet;
+			break;
+		}
+	}
+
+	return seq;
+}
+
+#endif